@@ -0,0 +1,127 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "benchmarks.h"
+#include <QtTest>
+
+Benchmarks::Benchmarks(const QString& qmlfmtPath, QObject *parent) : QObject(parent), m_qmlfmtPath(qmlfmtPath)
+{
+}
+
+QString Benchmarks::writeFile(const QString& name, const QString& content)
+{
+    const QString fileName = m_dir.filePath(name);
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QFile file(fileName);
+    file.open(QFile::WriteOnly | QFile::Truncate);
+    file.write(content.toUtf8());
+    return fileName;
+}
+
+void Benchmarks::runQmlFmt(const QStringList& arguments)
+{
+    QProcess process;
+    process.setStandardOutputFile(QProcess::nullDevice());
+    process.start(m_qmlfmtPath, arguments);
+    QVERIFY(process.waitForFinished(-1));
+    QCOMPARE(process.exitCode(), 0);
+}
+
+void Benchmarks::SkewedCorpus_data()
+{
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<QString>("jobs");
+
+    // Many small files and one big one found last. The corpus on all cores should take about as long as the big
+    // file alone, which it can only if the big file is started first.
+    QString small = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 50; index++)
+        small += QString("  Rectangle { width: %1; height: width*2 }\n").arg(index);
+    small += "}\n";
+
+    QString big = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 40000; index++)
+        big += QString("  Rectangle { width: %1; height: width*2 }\n").arg(index);
+    big += "}\n";
+
+    for (int index = 0; index < 400; index++)
+        writeFile(QString("skewed/small%1.qml").arg(index, 3, 10, QChar('0')), small);
+    const QString bigFile = writeFile("skewed/zz_big.qml", big);
+
+    // Chunked formatting is turned off, it would spread the big file over all cores and hide what is measured here
+    QTest::newRow("big file alone") << bigFile << "0";
+    QTest::newRow("corpus on one core") << m_dir.filePath("skewed") << "1";
+    QTest::newRow("corpus on all cores") << m_dir.filePath("skewed") << "0";
+}
+
+void Benchmarks::SkewedCorpus()
+{
+    QFETCH(QString, path);
+    QFETCH(QString, jobs);
+
+    QBENCHMARK
+    {
+        runQmlFmt({ path, "-j", jobs, "--stream-threshold", "0" });
+    }
+}
+
+void Benchmarks::RepetitiveFile_data()
+{
+    QTest::addColumn<QString>("fileName");
+    QTest::addColumn<QString>("threshold");
+
+    // A large generated file repeating the same objects, with small members between them. In chunks the objects
+    // are formatted once and taken from the cache after that.
+    QString rectangle = "  Rectangle {\n    color: \"red\"\n";
+    for (int line = 0; line < 40; line++)
+        rectangle += QString("    property int value%1: %1\n").arg(line);
+    rectangle += "    Text { text: qsTr(\"Hello\") }\n  }\n";
+
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 4000; index++)
+    {
+        content += rectangle;
+        content += QString("  PropertyChanges { target: item%1; visible: false }\n").arg(index);
+    }
+    content += "}\n";
+
+    const QString fileName = writeFile("repetitive.qml", content);
+    QTest::newRow("whole") << fileName << "0";
+    QTest::newRow("in chunks") << fileName << "1";
+}
+
+void Benchmarks::RepetitiveFile()
+{
+    QFETCH(QString, fileName);
+    QFETCH(QString, threshold);
+
+    QBENCHMARK
+    {
+        runQmlFmt({ fileName, "--stream-threshold", threshold });
+    }
+}
@@ -0,0 +1,55 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTemporaryDir>
+
+// Timings of whole qmlfmt runs on generated inputs, run on demand rather than as part of the tests.
+class Benchmarks : public QObject
+{
+    Q_OBJECT
+
+public:
+    Benchmarks(const QString& qmlfmtPath, QObject *parent = nullptr);
+
+private:
+    QString m_qmlfmtPath;
+    QTemporaryDir m_dir;
+
+    QString writeFile(const QString& name, const QString& content);
+    void runQmlFmt(const QStringList& arguments);
+
+private slots:
+    void SkewedCorpus();
+    void SkewedCorpus_data();
+    void RepetitiveFile();
+    void RepetitiveFile_data();
+};
@@ -0,0 +1,635 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QCryptographicHash>
+#include <QIODevice>
+#include <QScopeGuard>
+#include <QSet>
+#include <QThread>
+#include <QtConcurrent>
+#include <cstring>
+
+#include <qmljs/qmljsdocument.h>
+#include <qmljs/qmljsmodelmanagerinterface.h>
+#include <qmljs/qmljsreformatter.h>
+
+#include "chunkedformatter.h"
+#include "sinks.h"
+
+// Member standing in for the members before and after a chunk, chosen not to clash with real code.
+static const char PlaceholderName[] = "__qmlfmt_placeholder__";
+static const char Placeholder[] = "__qmlfmt_placeholder__: 0";
+
+// How much of the file is read at once.
+static const qint64 BlockSize = 1 << 16;
+
+// How far the scanner looks ahead, enough for the keyword after a line break.
+static const qint64 LookAhead = 16;
+
+// How many members the formatter remembers having seen before it starts over, which bounds its memory use.
+static const qsizetype MaxSeenMembers = 1 << 16;
+
+// Chunks are queued ahead of other work on the global pool, so the files already started finish first.
+static const int ChunkPriority = 1;
+
+// Members shorter than this many bytes are formatted along with the members around them, as a chunk of their own
+// would cost more than formatting them again.
+static const qint64 MinCachedMember = 1 << 10;
+
+// A line ending in one of these is continued on the next line.
+static bool IsContinuation(char c)
+{
+    return c == 0 || strchr("+-*/%=&|^!~?:,.([{<>", c) != nullptr;
+}
+
+// A slash after one of these starts a regular expression rather than a division.
+static bool StartsRegex(char c)
+{
+    return c == 0 || strchr("(,=:[!&|?{};+-*%<>~^", c) != nullptr;
+}
+
+static bool IsIdentifierStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$';
+}
+
+ChunkCache::ChunkCache(qint64 maxCharacters)
+    : m_pieces(maxCharacters)
+{
+}
+
+bool ChunkCache::Find(const QByteArray& key, QString& piece)
+{
+    QMutexLocker locker(&m_mutex);
+    const QString* cached = m_pieces.object(key);
+    if (cached == nullptr)
+        return false;
+
+    piece = *cached;
+    return true;
+}
+
+void ChunkCache::Insert(const QByteArray& key, const QString& piece)
+{
+    // Pieces cost their length, with a minimum for the key and bookkeeping
+    QMutexLocker locker(&m_mutex);
+    m_pieces.insert(key, new QString(piece), qMax<qsizetype>(piece.size(), 64));
+}
+
+ChunkedFormatter::ChunkedFormatter(const QString& path, int indentSize, int tabSize, int lineLength, qint64 chunkSize,
+    ChunkCache* cache)
+    : m_path(path)
+    , m_indentSize(indentSize)
+    , m_tabSize(tabSize)
+    , m_lineLength(lineLength)
+    , m_chunkSize(chunkSize)
+    , m_cache(cache)
+    , m_jobs(1)
+    , m_chunks(0)
+    // "Item", "Behavior on x", "anchors", "delegate: Item" or "property Item item: Item", anything else
+    // opening a brace is code, which is never split
+    , m_objectHeader(R"(^(?:(?:readonly|default|required)\s+)*(?:property\s+[\w.]+(?:<[\w.]+>)?\s+\w+\s*:\s*)?)"
+                     R"((?:[\w.]+\s*:\s*)?[\w.]+(?:\s+on\s+[\w.]+)?\s*$)")
+{
+}
+
+void ChunkedFormatter::SetJobs(int jobs)
+{
+    m_jobs = qMax(jobs, 1);
+}
+
+int ChunkedFormatter::Chunks() const
+{
+    return m_chunks;
+}
+
+bool ChunkedFormatter::Format(QIODevice& input, Sink& output)
+{
+    enum State { Code, LineComment, BlockComment, String, Template, Regex };
+
+    QByteArray buffer;
+    QList<Scope> scopes;
+    QList<Scope> chunkScopes;
+    QList<Scope> pendingScopes;
+    qint64 pendingEnd = 0;
+    QSet<QByteArray> seen;
+    int codeScopes = 0;
+    State state = Code;
+    char quote = 0;
+    bool inClass = false;
+    char lastSignificant = 0;
+    qint64 position = 0;
+    qint64 memberStart = 0;
+    bool memberStarted = false;
+    qint64 boundary = -1;
+    bool atEnd = false;
+    m_chunks = 0;
+
+    // Chunks being formatted, oldest first. None are left running when formatting stops, they use this. A thread
+    // of the global pool waiting for them gives its place in the pool to them meanwhile.
+    QThreadPool* pool = QThreadPool::globalInstance();
+    const bool inPool = pool->contains(QThread::currentThread());
+    QList<QFuture<std::optional<QString>>> formatting;
+    const auto waitFor = [&](QFuture<std::optional<QString>>& future) {
+        if (future.isFinished())
+            return;
+
+        if (inPool)
+            pool->releaseThread();
+        future.waitForFinished();
+        if (inPool)
+            pool->reserveThread();
+    };
+    const auto wait = qScopeGuard([&]() {
+        for (QFuture<std::optional<QString>>& future : formatting)
+            waitFor(future);
+    });
+
+    // Writes the oldest chunk being formatted once it is done
+    const auto writeChunk = [&]() {
+        QFuture<std::optional<QString>> future = formatting.takeFirst();
+        waitFor(future);
+        const std::optional<QString> piece = future.result();
+        return piece.has_value() && output.Write(*piece);
+    };
+
+    // Starts formatting the chunk before end and drops it from the buffer, writing the oldest chunks while all
+    // jobs are taken. With one job the chunk is formatted right here.
+    const auto emitChunk = [&](qint64 end, const QList<Scope>& endScopes, const QByteArray& key) {
+        m_chunks++;
+        if (m_jobs == 1)
+        {
+            formatting.append(QtFuture::makeReadyValueFuture(FormatCachedChunk(chunkScopes, buffer.left(end), endScopes, key)));
+        }
+        else
+        {
+            formatting.append(QtConcurrent::task([this, startScopes = chunkScopes, text = buffer.left(end), endScopes, key]() {
+                return FormatCachedChunk(startScopes, text, endScopes, key);
+            }).onThreadPool(*pool).withPriority(ChunkPriority).spawn());
+        }
+
+        while (formatting.count() >= m_jobs)
+        {
+            if (!writeChunk())
+                return false;
+        }
+
+        buffer.remove(0, end);
+        position -= end;
+        memberStart -= end;
+        chunkScopes = endScopes;
+        pendingScopes = endScopes;
+        pendingEnd = 0;
+        return true;
+    };
+
+    while (true)
+    {
+        while (!atEnd && buffer.size() - position < LookAhead)
+        {
+            const QByteArray block = input.read(BlockSize);
+            atEnd = block.isEmpty();
+            buffer.append(block);
+        }
+
+        if (position >= buffer.size())
+            break;
+
+        const char c = buffer[position];
+        const char next = position + 1 < buffer.size() ? buffer[position + 1] : 0;
+        switch (state)
+        {
+        case LineComment:
+            // The line break is handled as code, it may end a member
+            if (c == '\n')
+                state = Code;
+            else
+                position++;
+            continue;
+
+        case BlockComment:
+            if (c == '*' && next == '/')
+            {
+                state = Code;
+                position++;
+
+                // A comment before a member goes with it, but is not part of its header
+                if (codeScopes == 0 && !memberStarted)
+                    memberStart = position + 1;
+            }
+            position++;
+            continue;
+
+        case String:
+            if (c == '\\')
+                position++;
+            else if (c == quote)
+            {
+                state = Code;
+                lastSignificant = '"';
+            }
+            position++;
+            continue;
+
+        case Template:
+            if (c == '\\')
+            {
+                position++;
+            }
+            else if (c == '`')
+            {
+                scopes.removeLast();
+                codeScopes--;
+                state = Code;
+                lastSignificant = '"';
+            }
+            else if (c == '$' && next == '{')
+            {
+                scopes.append({ Scope::TemplateExpression, QByteArray() });
+                codeScopes++;
+                state = Code;
+                lastSignificant = '{';
+                position++;
+            }
+            position++;
+            continue;
+
+        case Regex:
+            if (c == '\\')
+                position++;
+            else if (c == '[')
+                inClass = true;
+            else if (c == ']')
+                inClass = false;
+            else if (c == '/' && !inClass)
+            {
+                state = Code;
+                lastSignificant = 'a';
+            }
+            else if (c == '\n')
+                return false;
+            position++;
+            continue;
+
+        case Code:
+            break;
+        }
+
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+        {
+            // A line break between members of objects only is where the file may be split. Comments and
+            // blank lines after it go with the next member.
+            if (c == '\n' && !scopes.isEmpty() && codeScopes == 0 && !IsContinuation(lastSignificant))
+            {
+                if (boundary < 0)
+                    boundary = position + 1;
+                memberStart = position + 1;
+                memberStarted = false;
+            }
+            position++;
+            continue;
+        }
+
+        if (c == '/' && (next == '/' || next == '*'))
+        {
+            state = next == '/' ? LineComment : BlockComment;
+            position += 2;
+            continue;
+        }
+
+        if (boundary >= 0)
+        {
+            // Split if the chunk is big enough and the next line does not continue the member before it
+            qint64 wordEnd = position;
+            while (wordEnd < buffer.size() && (IsIdentifierStart(buffer[wordEnd]) || (buffer[wordEnd] >= '0' && buffer[wordEnd] <= '9')))
+                wordEnd++;
+
+            const QByteArray word = buffer.mid(position, wordEnd - position);
+            const bool startsMember = (IsIdentifierStart(c) && word != "else" && word != "catch" && word != "finally") || c == '}';
+            if (startsMember)
+            {
+                // The text since the last member ended is a whole member only if it ends in the object it started
+                // in. A member seen before goes on its own, after the members pending before it, so that it and
+                // every later copy of it are formatted once.
+                const qint64 memberLength = boundary - pendingEnd;
+                bool cached = false;
+                if (m_cache != nullptr && scopes.count() == pendingScopes.count() && memberLength >= MinCachedMember)
+                {
+                    const QByteArray key = ChunkKey(pendingScopes, buffer.mid(pendingEnd, memberLength), scopes);
+                    QString piece;
+                    cached = seen.contains(key) || m_cache->Find(key, piece);
+                    if (cached)
+                    {
+                        if (pendingEnd > 0 && !emitChunk(pendingEnd, pendingScopes, QByteArray()))
+                            return false;
+
+                        if (!emitChunk(memberLength, scopes, key))
+                            return false;
+                    }
+                    else
+                    {
+                        if (seen.size() >= MaxSeenMembers)
+                            seen.clear();
+
+                        seen.insert(key);
+                    }
+                }
+
+                if (!cached)
+                {
+                    // A member that opened an object goes on until it closes it. Closers and the root header
+                    // are never members of their own.
+                    if (scopes.count() <= pendingScopes.count() || pendingScopes.isEmpty())
+                    {
+                        pendingEnd = boundary;
+                        pendingScopes = scopes;
+                    }
+
+                    if (boundary >= m_chunkSize && !emitChunk(boundary, scopes, QByteArray()))
+                        return false;
+                }
+            }
+
+            boundary = -1;
+        }
+
+        memberStarted = true;
+        switch (c)
+        {
+        case '"':
+        case '\'':
+            state = String;
+            quote = c;
+            break;
+
+        case '`':
+            scopes.append({ Scope::Template, QByteArray() });
+            codeScopes++;
+            state = Template;
+            break;
+
+        case '/':
+            if (StartsRegex(lastSignificant))
+            {
+                state = Regex;
+                inClass = false;
+            }
+            break;
+
+        case '{':
+            if (scopes.isEmpty())
+            {
+                // The root object, its header holds the imports before it
+                const QByteArray header = buffer.left(position + 1);
+                scopes.append({ Scope::Object, header, Chain(scopes, header) });
+                memberStart = position + 1;
+                memberStarted = false;
+            }
+            else if (codeScopes == 0 && m_objectHeader.match(QString::fromUtf8(buffer.mid(memberStart, position - memberStart)).trimmed()).hasMatch())
+            {
+                const QByteArray header = buffer.mid(memberStart, position + 1 - memberStart).trimmed();
+                scopes.append({ Scope::Object, header, Chain(scopes, header) });
+                memberStart = position + 1;
+                memberStarted = false;
+            }
+            else
+            {
+                scopes.append({ Scope::Block, QByteArray() });
+                codeScopes++;
+            }
+            break;
+
+        case '(':
+            scopes.append({ Scope::Paren, QByteArray() });
+            codeScopes++;
+            break;
+
+        case '[':
+            scopes.append({ Scope::Bracket, QByteArray() });
+            codeScopes++;
+            break;
+
+        case '}':
+        case ')':
+        case ']':
+        {
+            const Scope::Kind expected = c == ')' ? Scope::Paren : c == ']' ? Scope::Bracket : Scope::Object;
+            if (scopes.isEmpty())
+                return false;
+
+            const Scope::Kind kind = scopes.takeLast().kind;
+            if (kind != Scope::Object)
+                codeScopes--;
+
+            if (kind == Scope::TemplateExpression && c == '}')
+                state = Template;
+            else if (kind != expected && !(c == '}' && kind == Scope::Block))
+                return false;
+            break;
+        }
+
+        case ';':
+            if (codeScopes == 0)
+            {
+                memberStart = position + 1;
+                memberStarted = false;
+            }
+            break;
+        }
+
+        if (state == Code)
+            lastSignificant = c;
+        position++;
+    }
+
+    // Whatever is left holds the end of the root object
+    if (!scopes.isEmpty() || (state != Code && state != LineComment))
+        return false;
+
+    if (!emitChunk(buffer.size(), scopes, QByteArray()))
+        return false;
+
+    while (!formatting.isEmpty())
+    {
+        if (!writeChunk())
+            return false;
+    }
+
+    return true;
+}
+
+std::optional<QString> ChunkedFormatter::FormatCachedChunk(const QList<Scope>& startScopes, const QByteArray& text,
+    const QList<Scope>& endScopes, const QByteArray& key)
+{
+    // Chunks with a key go through the cache
+    QString piece;
+    if (!key.isEmpty() && m_cache->Find(key, piece))
+        return piece;
+
+    if (!FormatChunk(startScopes, text, endScopes, piece))
+        return std::nullopt;
+
+    if (!key.isEmpty())
+        m_cache->Insert(key, piece);
+
+    return piece;
+}
+
+QByteArray ChunkedFormatter::Chain(const QList<Scope>& scopes, const QByteArray& header)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    if (!scopes.isEmpty())
+        hash.addData(scopes.last().chain);
+
+    hash.addData(header);
+    return hash.result();
+}
+
+QByteArray ChunkedFormatter::ChunkKey(const QList<Scope>& startScopes, const QByteArray& text, const QList<Scope>& endScopes) const
+{
+    // The same text formats the same in the same objects with the same options
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QString("%1 %2 %3 ").arg(m_indentSize).arg(m_tabSize).arg(m_lineLength).toUtf8());
+    hash.addData(startScopes.isEmpty() ? QByteArray(20, 0) : startScopes.last().chain);
+    hash.addData(endScopes.isEmpty() ? QByteArray(20, 0) : endScopes.last().chain);
+    hash.addData(text);
+    return hash.result();
+}
+
+bool ChunkedFormatter::FormatChunk(const QList<Scope>& startScopes, const QByteArray& text, const QList<Scope>& endScopes, QString& piece)
+{
+    if (text.contains(PlaceholderName))
+        return false;
+
+    // The first chunk starts the file and the last one ends it, they have no placeholder there
+    const bool first = startScopes.isEmpty();
+    const bool last = endScopes.isEmpty();
+    QString skeleton;
+    if (!first)
+        skeleton = Openers(startScopes) + "\n" + Placeholder + "\n";
+
+    skeleton += QString::fromUtf8(text);
+    if (!last)
+        skeleton += QString(Placeholder) + "\n" + Closers(endScopes);
+
+    bool ok = true;
+    const QString output = Reformat(skeleton, ok);
+    if (!ok || output.count(Placeholder) != !first + !last)
+        return false;
+
+    // The text before the first placeholder must be what the objects the chunk is in always format to
+    qsizetype begin = 0;
+    if (!first)
+    {
+        const qsizetype placeholder = output.indexOf(Placeholder);
+        const qsizetype lineStart = output.lastIndexOf('\n', placeholder) + 1;
+        const qsizetype lineEnd = output.indexOf('\n', placeholder);
+        if (lineEnd != placeholder + qsizetype(strlen(Placeholder)) || !output.mid(lineStart, placeholder - lineStart).trimmed().isEmpty())
+            return false;
+
+        if (output.left(lineStart) != Prefix(startScopes, ok) || !ok)
+            return false;
+
+        begin = lineEnd + 1;
+    }
+
+    qsizetype end = output.size();
+    if (!last)
+    {
+        const qsizetype placeholder = output.lastIndexOf(Placeholder);
+        const qsizetype lineStart = output.lastIndexOf('\n', placeholder) + 1;
+        if (lineStart < begin || !output.mid(lineStart, placeholder - lineStart).trimmed().isEmpty())
+            return false;
+
+        // Only the closing braces of the skeleton may follow
+        for (QChar c : QStringView(output).mid(placeholder + strlen(Placeholder)))
+        {
+            if (c != '}' && !c.isSpace())
+                return false;
+        }
+
+        end = lineStart;
+    }
+
+    piece = output.mid(begin, end - begin);
+    return true;
+}
+
+QString ChunkedFormatter::Prefix(const QList<Scope>& scopes, bool& ok)
+{
+    // What the objects of a chunk format to before the placeholder, the same for every chunk in them
+    const QString openers = Openers(scopes);
+    QMutexLocker locker(&m_prefixesMutex);
+    const auto cached = m_prefixes.constFind(openers);
+    if (cached != m_prefixes.constEnd())
+        return *cached;
+
+    locker.unlock();
+
+    const QString output = Reformat(openers + "\n" + Placeholder + "\n" + Closers(scopes), ok);
+    const qsizetype placeholder = output.indexOf(Placeholder);
+    if (!ok || placeholder < 0)
+    {
+        ok = false;
+        return QString();
+    }
+
+    const QString prefix = output.left(output.lastIndexOf('\n', placeholder) + 1);
+    locker.relock();
+    m_prefixes.insert(openers, prefix);
+    return prefix;
+}
+
+QString ChunkedFormatter::Reformat(const QString& source, bool& ok) const
+{
+    const Utils::FilePath filePath = Utils::FilePath::fromString(m_path);
+    QmlJS::Document::MutablePtr document = QmlJS::Document::create(filePath, QmlJS::ModelManagerInterface::guessLanguageOfFile(filePath));
+    document->setSource(source);
+    document->parse();
+    if (!document->diagnosticMessages().isEmpty())
+    {
+        ok = false;
+        return QString();
+    }
+
+    return QmlJS::reformat(document, m_indentSize, m_tabSize, m_lineLength);
+}
+
+QString ChunkedFormatter::Openers(const QList<Scope>& scopes)
+{
+    QStringList headers;
+    for (const Scope& scope : scopes)
+        headers.append(QString::fromUtf8(scope.header));
+
+    return headers.join('\n');
+}
+
+QString ChunkedFormatter::Closers(const QList<Scope>& scopes)
+{
+    return QString("}\n").repeated(scopes.count());
+}
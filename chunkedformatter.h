@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QCache>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QRegularExpression>
+#include <QString>
+#include <optional>
+
+class QIODevice;
+class Sink;
+
+// Formatted chunks by their text and the objects around them, shared by all files of a run. Keeps the most
+// recently used chunks up to a budget of characters.
+class ChunkCache
+{
+public:
+    explicit ChunkCache(qint64 maxCharacters);
+
+    bool Find(const QByteArray& key, QString& piece);
+    void Insert(const QByteArray& key, const QString& piece);
+
+private:
+    QMutex m_mutex;
+    QCache<QByteArray, QString> m_pieces;
+};
+
+// Formats a QML file chunk by chunk, so memory stays bounded however big the file is. The file is split between
+// members of its objects, found by a scanner that only follows brackets, strings and comments. Every chunk is
+// formatted inside a skeleton of the objects it is in, after a placeholder member standing in for the members
+// before it and before one standing in for the members after it. What the reformatter puts between the two
+// placeholders is the chunk's share of the output.
+//
+// Chunks can be formatted on several threads at once, they are still written in order and come out the same.
+//
+// With a cache, a member of a kilobyte or more seen before in the file is formatted on its own, and every later
+// copy of it in the same objects is taken from the cache instead of being formatted again.
+class ChunkedFormatter
+{
+public:
+    ChunkedFormatter(const QString& path, int indentSize, int tabSize, int lineLength, qint64 chunkSize,
+        ChunkCache* cache = nullptr);
+
+    // Formats input to output a chunk at a time. Returns false if input cannot be formatted this way, e.g.
+    // because it does not parse, or output stopped taking it. Output then got part of the result at most, and
+    // the file has to be formatted as a whole if all of it is needed.
+    bool Format(QIODevice& input, Sink& output);
+
+    // How many chunks to format at once on the global thread pool, 1 by default. With one, chunks are formatted on
+    // the calling thread.
+    void SetJobs(int jobs);
+
+    // How many chunks the last call to Format split the file into, up to where it stopped.
+    int Chunks() const;
+
+private:
+    // A bracket the scanner is in, objects also keep the source text that opened them and a hash of that and
+    // the headers of the objects around them
+    struct Scope
+    {
+        enum Kind { Object, Block, Paren, Bracket, Template, TemplateExpression };
+        Kind kind;
+        QByteArray header;
+        QByteArray chain;
+    };
+
+    static QByteArray Chain(const QList<Scope>& scopes, const QByteArray& header);
+    QByteArray ChunkKey(const QList<Scope>& startScopes, const QByteArray& text, const QList<Scope>& endScopes) const;
+    bool FormatChunk(const QList<Scope>& startScopes, const QByteArray& text, const QList<Scope>& endScopes, QString& piece);
+    std::optional<QString> FormatCachedChunk(const QList<Scope>& startScopes, const QByteArray& text,
+        const QList<Scope>& endScopes, const QByteArray& key);
+    QString Prefix(const QList<Scope>& scopes, bool& ok);
+    QString Reformat(const QString& source, bool& ok) const;
+    static QString Openers(const QList<Scope>& scopes);
+    static QString Closers(const QList<Scope>& scopes);
+
+    QString m_path;
+    int m_indentSize;
+    int m_tabSize;
+    int m_lineLength;
+    qint64 m_chunkSize;
+    ChunkCache* m_cache;
+    int m_jobs;
+    int m_chunks;
+    QRegularExpression m_objectHeader;
+    QMutex m_prefixesMutex;
+    QHash<QString, QString> m_prefixes;
+};
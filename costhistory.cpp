@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QStringList>
+
+#include "costhistory.h"
+
+// Bumped whenever the layout of the history file changes, older files are discarded.
+static const int FormatVersion = 1;
+
+// Upper bound on the number of files remembered.
+static const int MaxEntries = 50000;
+
+void CostHistory::Load(const QString& fileName)
+{
+    m_entries.clear();
+    m_generation = 0;
+    m_costPerByte = DefaultCostPerByte;
+
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return;
+
+    const QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    if (root["version"].toInt() != FormatVersion)
+        return;
+
+    m_generation = root["generation"].toInteger();
+
+    qint64 totalCost = 0;
+    qint64 totalSize = 0;
+    for (const QJsonValue& value : root["entries"].toArray())
+    {
+        const QJsonObject object = value.toObject();
+        Entry entry;
+        entry.hash = QByteArray::fromHex(object["hash"].toString().toLatin1());
+        entry.size = object["size"].toInteger();
+        entry.cost = object["cost"].toInteger();
+        entry.lastUsed = object["used"].toInteger();
+        m_entries.insert(object["path"].toString(), entry);
+
+        totalCost += entry.cost;
+        totalSize += entry.size;
+    }
+
+    if (totalCost > 0 && totalSize > 0)
+        m_costPerByte = static_cast<double>(totalCost) / totalSize;
+}
+
+bool CostHistory::Save(const QString& fileName)
+{
+    m_generation++;
+
+    QStringList paths = m_entries.keys();
+    if (paths.size() > MaxEntries)
+    {
+        // Forget the files not seen for the longest time
+        std::nth_element(paths.begin(), paths.begin() + MaxEntries, paths.end(), [this](const QString& a, const QString& b) {
+            return m_entries[a].lastUsed > m_entries[b].lastUsed;
+        });
+        paths.resize(MaxEntries);
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    QJsonArray entries;
+    for (const QString& path : paths)
+    {
+        const Entry& entry = m_entries[path];
+        QJsonObject object;
+        object["path"] = path;
+        object["hash"] = QString::fromLatin1(entry.hash.toHex());
+        object["size"] = entry.size;
+        object["cost"] = entry.cost;
+        object["used"] = entry.lastUsed;
+        entries.append(object);
+    }
+
+    QJsonObject root;
+    root["version"] = FormatVersion;
+    root["qmlfmt"] = QMLFMT_VERSION;
+    root["generation"] = m_generation;
+    root["entries"] = entries;
+
+    QSaveFile file(fileName);
+    if (!file.open(QFile::WriteOnly))
+        return false;
+
+    file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+qint64 CostHistory::Estimate(const QString& path, qint64 size) const
+{
+    const auto entry = m_entries.constFind(path);
+    if (entry == m_entries.constEnd() || entry->size <= 0)
+        return static_cast<qint64>(size * m_costPerByte);
+
+    // The file may have changed since, assume its cost grew or shrank with its size.
+    return entry->cost * size / entry->size;
+}
+
+void CostHistory::Record(const QString& path, const QByteArray& hash, qint64 size, qint64 cost)
+{
+    Entry& entry = m_entries[path];
+    if (entry.hash == hash)
+    {
+        // Same content as before, smooth out timing noise
+        entry.cost = (entry.cost + cost) / 2;
+    }
+    else
+    {
+        entry.hash = hash;
+        entry.cost = cost;
+    }
+
+    entry.size = size;
+    entry.lastUsed = m_generation + 1;
+}
@@ -0,0 +1,68 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+
+// Measured cost of formatting files in earlier runs, used to schedule the slowest files first.
+// Size alone is a poor predictor for QML, deeply nested bindings take far longer than flat property lists.
+class CostHistory
+{
+public:
+    // Loads the history. A missing or unreadable file, or one written in another format version, is an empty history.
+    void Load(const QString& fileName);
+
+    // Saves the history, keeping only the most recently used entries.
+    bool Save(const QString& fileName);
+
+    // Estimated cost of formatting path in nanoseconds. Files without history are estimated from their size.
+    qint64 Estimate(const QString& path, qint64 size) const;
+
+    // Records the cost of formatting path with content hashed to hash.
+    void Record(const QString& path, const QByteArray& hash, qint64 size, qint64 cost);
+
+private:
+    struct Entry
+    {
+        QByteArray hash;
+        qint64 size = 0;
+        qint64 cost = 0;
+        qint64 lastUsed = 0;
+    };
+
+    QHash<QString, Entry> m_entries;
+    // Bumped on every save, entries remember the last run that recorded them.
+    qint64 m_generation = 0;
+    // Rough guess of the cost per byte, before there is any history.
+    static constexpr double DefaultCostPerByte = 200.0;
+    // Average cost per byte over the loaded entries.
+    double m_costPerByte = DefaultCostPerByte;
+};
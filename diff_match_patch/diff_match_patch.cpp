@@ -24,7 +24,7 @@
 // Code known to compile and run with Qt 4.3 through Qt 4.7.
 #include <QtCore>
 #include <QRegExp>
-#include <time.h>
+#include <QtConcurrent>
 #include "diff_match_patch.h"
 
 
@@ -166,7 +166,9 @@ QString Patch::toString() {
 /////////////////////////////////////////////
 
 diff_match_patch::diff_match_patch() :
-  Diff_Timeout(1.0f),
+  Diff_Budget(50000000),
+  Diff_Algorithm(MYERS),
+  Diff_ParallelLines(0),
   Diff_EditCost(4),
   Match_Threshold(0.5f),
   Match_Distance(1000),
@@ -183,18 +185,16 @@ QList<Diff> diff_match_patch::diff_main(const QString &text1,
 
 QList<Diff> diff_match_patch::diff_main(const QString &text1,
     const QString &text2, bool checklines) {
-  // Set a deadline by which time the diff must be complete.
-  clock_t deadline;
-  if (Diff_Timeout <= 0) {
-    deadline = std::numeric_limits<clock_t>::max();
-  } else {
-    deadline = clock() + (clock_t)(Diff_Timeout * CLOCKS_PER_SEC);
-  }
-  return diff_main(text1, text2, checklines, deadline);
+  // Set a budget within which the diff must be complete.
+  DiffBudget budget;
+  budget.cells = Diff_Budget > 0 ? Diff_Budget : std::numeric_limits<qint64>::max();
+  budget.fallbackCells = budget.cells;
+  budget.lineFallback = false;
+  return diff_main(text1, text2, checklines, budget);
 }
 
 QList<Diff> diff_match_patch::diff_main(const QString &text1,
-    const QString &text2, bool checklines, clock_t deadline) {
+    const QString &text2, bool checklines, DiffBudget &budget) {
   // Check for null inputs.
   if (text1.isNull() || text2.isNull()) {
     throw "Null inputs. (diff_main)";
@@ -222,7 +222,7 @@ QList<Diff> diff_match_patch::diff_main(const QString &text1,
   textChopped2 = textChopped2.left(textChopped2.length() - commonlength);
 
   // Compute the diff on the middle block.
-  diffs = diff_compute(textChopped1, textChopped2, checklines, deadline);
+  diffs = diff_compute(textChopped1, textChopped2, checklines, budget);
 
   // Restore the prefix and suffix.
   if (!commonprefix.isEmpty()) {
@@ -239,7 +239,7 @@ QList<Diff> diff_match_patch::diff_main(const QString &text1,
 
 
 QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
-    bool checklines, clock_t deadline) {
+    bool checklines, DiffBudget &budget) {
   QList<Diff> diffs;
 
   if (text1.isEmpty()) {
@@ -277,6 +277,11 @@ QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
     // Garbage collect longtext and shorttext by scoping out.
   }
 
+  if (checklines && Diff_Algorithm != MYERS) {
+    // Anchored algorithms line up whole lines before anything else.
+    return diff_lineMode(text1, text2, budget);
+  }
+
   // Check to see if the problem can be split in two.
   const QStringList hm = diff_halfMatch(text1, text2);
   if (hm.count() > 0) {
@@ -288,9 +293,9 @@ QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
     const QString mid_common = hm[4];
     // Send both pairs off for separate processing.
     const QList<Diff> diffs_a = diff_main(text1_a, text2_a,
-                                          checklines, deadline);
+                                          checklines, budget);
     const QList<Diff> diffs_b = diff_main(text1_b, text2_b,
-                                          checklines, deadline);
+                                          checklines, budget);
     // Merge the results.
     diffs = diffs_a;
     diffs.append(Diff(EQUAL, mid_common));
@@ -300,22 +305,34 @@ QList<Diff> diff_match_patch::diff_compute(QString text1, QString text2,
 
   // Perform a real diff.
   if (checklines && text1.length() > 100 && text2.length() > 100) {
-    return diff_lineMode(text1, text2, deadline);
+    return diff_lineMode(text1, text2, budget);
   }
 
-  return diff_bisect(text1, text2, deadline);
+  return diff_bisect(text1, text2, budget);
 }
 
 
 QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
-    clock_t deadline) {
+    DiffBudget &budget) {
   // Scan the text on a line-by-line basis first.
   const QList<QVariant> b = diff_linesToChars(text1, text2);
   text1 = b[0].toString();
   text2 = b[1].toString();
   QStringList linearray = b[2].toStringList();
 
-  QList<Diff> diffs = diff_main(text1, text2, false, deadline);
+  // Line hashes have no finer granularity to fall back to.
+  const bool lineFallback = budget.lineFallback;
+  budget.lineFallback = true;
+  QList<Diff> diffs;
+  if (Diff_Algorithm == MYERS) {
+    diffs = diff_main(text1, text2, false, budget);
+  } else {
+    // Huge texts are diffed between their anchors concurrently.
+    diffs = Diff_ParallelLines > 0 ? diff_parallel(text1, text2, budget)
+                                   : diff_anchored(text1, text2, budget);
+    diff_cleanupMerge(diffs);
+  }
+  budget.lineFallback = lineFallback;
 
   // Convert the diff back to original text.
   diff_charsToLines(diffs, linearray);
@@ -352,7 +369,7 @@ QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
             pointer.remove();
           }
           foreach(Diff newDiff,
-              diff_main(text_delete, text_insert, false, deadline)) {
+              diff_main(text_delete, text_insert, false, budget)) {
             pointer.insert(newDiff);
           }
         }
@@ -371,7 +388,7 @@ QList<Diff> diff_match_patch::diff_lineMode(QString text1, QString text2,
 
 
 QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
-    const QString &text2, clock_t deadline) {
+    const QString &text2, DiffBudget &budget) {
   // Cache the text lengths to prevent multiple calls.
   const int text1_length = text1.length();
   const int text2_length = text2.length();
@@ -397,8 +414,8 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
   int k2start = 0;
   int k2end = 0;
   for (int d = 0; d < max_d; d++) {
-    // Bail out if deadline is reached.
-    if (clock() > deadline) {
+    // Bail out if the budget is spent.
+    if (budget.cells <= 0) {
       break;
     }
 
@@ -412,10 +429,12 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
         x1 = v1[k1_offset - 1] + 1;
       }
       int y1 = x1 - k1;
+      budget.cells--;
       while (x1 < text1_length && y1 < text2_length
           && text1[x1] == text2[y1]) {
         x1++;
         y1++;
+        budget.cells--;
       }
       v1[k1_offset] = x1;
       if (x1 > text1_length) {
@@ -433,7 +452,7 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
             // Overlap detected.
             delete [] v1;
             delete [] v2;
-            return diff_bisectSplit(text1, text2, x1, y1, deadline);
+            return diff_bisectSplit(text1, text2, x1, y1, budget);
           }
         }
       }
@@ -449,10 +468,12 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
         x2 = v2[k2_offset - 1] + 1;
       }
       int y2 = x2 - k2;
+      budget.cells--;
       while (x2 < text1_length && y2 < text2_length
           && text1[text1_length - x2 - 1] == text2[text2_length - y2 - 1]) {
         x2++;
         y2++;
+        budget.cells--;
       }
       v2[k2_offset] = x2;
       if (x2 > text1_length) {
@@ -472,7 +493,7 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
             // Overlap detected.
             delete [] v1;
             delete [] v2;
-            return diff_bisectSplit(text1, text2, x1, y1, deadline);
+            return diff_bisectSplit(text1, text2, x1, y1, budget);
           }
         }
       }
@@ -480,7 +501,11 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
   }
   delete [] v1;
   delete [] v2;
-  // Diff took too long and hit the deadline or
+  if (budget.cells <= 0 && !budget.lineFallback) {
+    // Diff ran out of budget, settle for whole changed lines.
+    return diff_lineFallback(text1, text2, budget);
+  }
+  // Diff ran out of budget while already diffing lines or
   // number of diffs equals number of characters, no commonality at all.
   QList<Diff> diffs;
   diffs.append(Diff(DELETE, text1));
@@ -489,19 +514,354 @@ QList<Diff> diff_match_patch::diff_bisect(const QString &text1,
 }
 
 QList<Diff> diff_match_patch::diff_bisectSplit(const QString &text1,
-    const QString &text2, int x, int y, clock_t deadline) {
+    const QString &text2, int x, int y, DiffBudget &budget) {
   QString text1a = text1.left(x);
   QString text2a = text2.left(y);
   QString text1b = safeMid(text1, x);
   QString text2b = safeMid(text2, y);
 
   // Compute both diffs serially.
-  QList<Diff> diffs = diff_main(text1a, text2a, false, deadline);
-  QList<Diff> diffsb = diff_main(text1b, text2b, false, deadline);
+  QList<Diff> diffs = diff_main(text1a, text2a, false, budget);
+  QList<Diff> diffsb = diff_main(text1b, text2b, false, budget);
 
   return diffs + diffsb;
 }
 
+QList<Diff> diff_match_patch::diff_lineFallback(const QString &text1,
+    const QString &text2, DiffBudget &budget) {
+  QList<Diff> diffs;
+  const int lines1 = text1.count('\n');
+  const int lines2 = text2.count('\n');
+  if ((lines1 == 0 || (lines1 == 1 && text1.endsWith('\n')))
+      && (lines2 == 0 || (lines2 == 1 && text2.endsWith('\n')))) {
+    // Both texts are a single line, nothing coarser to fall back to.
+    diffs.append(Diff(DELETE, text1));
+    diffs.append(Diff(INSERT, text2));
+    return diffs;
+  }
+
+  const QList<QVariant> b = diff_linesToChars(text1, text2);
+  const QStringList linearray = b[2].toStringList();
+
+  // The budget for characters is spent by now, the line hashes draw from
+  // the allowance left to all fallbacks of this diff.
+  DiffBudget lineBudget;
+  lineBudget.cells = budget.fallbackCells;
+  lineBudget.fallbackCells = 0;
+  lineBudget.lineFallback = true;
+  diffs = diff_main(b[0].toString(), b[1].toString(), false, lineBudget);
+  budget.fallbackCells = lineBudget.cells;
+
+  diff_charsToLines(diffs, linearray);
+  return diffs;
+}
+
+
+QList<Diff> diff_match_patch::diff_anchored(const QString &text1,
+    const QString &text2, DiffBudget &budget) {
+  const DiffRange whole{0, static_cast<int>(text1.length()),
+                        0, static_cast<int>(text2.length()), DiffRange::ANCHOR};
+  return diff_anchored(text1, text2, whole, budget);
+}
+
+
+QList<Diff> diff_match_patch::diff_anchored(const QString &text1,
+    const QString &text2, const DiffRange &whole, DiffBudget &budget) {
+  // Ranges still to be diffed, or known to be equal, processed in text order
+  // so that diffs can be appended as soon as a range is resolved.
+  QList<Diff> diffs;
+  QVector<DiffRange> stack;
+  stack.append(whole);
+  while (!stack.isEmpty()) {
+    const DiffRange range = stack.takeLast();
+    if (range.kind == DiffRange::EQUAL) {
+      diffs.append(Diff(EQUAL, safeMid(text1, range.start1,
+                                       range.end1 - range.start1)));
+      continue;
+    }
+
+    if (range.kind == DiffRange::BISECT) {
+      // Nothing to anchor on, bisect what is left of the range.
+      diffs += diff_main(
+          safeMid(text1, range.start1, range.end1 - range.start1),
+          safeMid(text2, range.start2, range.end2 - range.start2),
+          false, budget);
+      continue;
+    }
+
+    if (range.start1 == range.end1 || range.start2 == range.end2) {
+      // Just add or delete some lines (speedup).
+      if (range.end1 > range.start1) {
+        diffs.append(Diff(DELETE, safeMid(text1, range.start1,
+                                          range.end1 - range.start1)));
+      }
+      if (range.end2 > range.start2) {
+        diffs.append(Diff(INSERT, safeMid(text2, range.start2,
+                                          range.end2 - range.start2)));
+      }
+      continue;
+    }
+
+    // Push the pieces in reverse, so the first is popped next.
+    const QVector<DiffRange> pieces = diff_anchorPieces(text1, text2, range);
+    for (int i = pieces.size() - 1; i >= 0; i--) {
+      stack.append(pieces[i]);
+    }
+  }
+  return diffs;
+}
+
+
+QVector<diff_match_patch::DiffRange> diff_match_patch::diff_anchorPieces(
+    const QString &text1, const QString &text2, const DiffRange &range) {
+  QVector<DiffRange> pieces;
+
+  // Trim off common prefix and suffix of the range.
+  int start1 = range.start1;
+  int start2 = range.start2;
+  while (start1 < range.end1 && start2 < range.end2
+      && text1[start1] == text2[start2]) {
+    start1++;
+    start2++;
+  }
+  if (start1 > range.start1) {
+    pieces.append(DiffRange{range.start1, start1, range.start2, start2,
+                            DiffRange::EQUAL});
+  }
+  int end1 = range.end1;
+  int end2 = range.end2;
+  while (end1 > start1 && end2 > start2
+      && text1[end1 - 1] == text2[end2 - 1]) {
+    end1--;
+    end2--;
+  }
+
+  if (start1 == end1 || start2 == end2) {
+    // Only lines added or deleted are left, if any.
+    if (start1 < end1 || start2 < end2) {
+      pieces.append(DiffRange{start1, end1, start2, end2, DiffRange::ANCHOR});
+    }
+  } else {
+    const QVector<int> anchors = Diff_Algorithm == PATIENCE
+        ? diff_patienceAnchors(text1, text2, start1, end1, start2, end2)
+        : diff_histogramAnchors(text1, text2, start1, end1, start2, end2);
+    int gap1 = start1;
+    int gap2 = start2;
+    for (int i = 0; i < anchors.size(); i += 3) {
+      if (gap1 < anchors[i] || gap2 < anchors[i + 1]) {
+        pieces.append(DiffRange{gap1, anchors[i], gap2, anchors[i + 1],
+                                DiffRange::ANCHOR});
+      }
+      pieces.append(DiffRange{anchors[i], anchors[i] + anchors[i + 2],
+                              anchors[i + 1], anchors[i + 1] + anchors[i + 2],
+                              DiffRange::EQUAL});
+      gap1 = anchors[i] + anchors[i + 2];
+      gap2 = anchors[i + 1] + anchors[i + 2];
+    }
+    if (anchors.isEmpty()) {
+      pieces.append(DiffRange{start1, end1, start2, end2, DiffRange::BISECT});
+    } else if (gap1 < end1 || gap2 < end2) {
+      pieces.append(DiffRange{gap1, end1, gap2, end2, DiffRange::ANCHOR});
+    }
+  }
+
+  if (end1 < range.end1) {
+    pieces.append(DiffRange{end1, range.end1, end2, range.end2,
+                            DiffRange::EQUAL});
+  }
+  return pieces;
+}
+
+
+QVector<int> diff_match_patch::diff_patienceAnchors(const QString &text1,
+    const QString &text2, int start1, int end1, int start2, int end2) {
+  QHash<ushort, int> count1;
+  QHash<ushort, int> count2;
+  QHash<ushort, int> index2;
+  for (int x = start1; x < end1; x++) {
+    count1[text1[x].unicode()]++;
+  }
+  for (int y = start2; y < end2; y++) {
+    count2[text2[y].unicode()]++;
+    index2[text2[y].unicode()] = y;
+  }
+
+  // Lines unique to both ranges, in text1 order.
+  QVector<int> candidates1;
+  QVector<int> candidates2;
+  for (int x = start1; x < end1; x++) {
+    const ushort line = text1[x].unicode();
+    if (count1.value(line) == 1 && count2.value(line) == 1) {
+      candidates1.append(x);
+      candidates2.append(index2.value(line));
+    }
+  }
+
+  QVector<int> anchors;
+  for (const int c : diff_longestIncreasing(candidates2)) {
+    anchors << candidates1[c] << candidates2[c] << 1;
+  }
+  return anchors;
+}
+
+
+QVector<int> diff_match_patch::diff_longestIncreasing(
+    const QVector<int> &values) {
+  // Each pile is represented by the index of the value on top of it.
+  QVector<int> piles;
+  QVector<int> previous(values.size(), -1);
+  for (int c = 0; c < values.size(); c++) {
+    int low = 0;
+    int high = piles.size();
+    while (low < high) {
+      const int mid = (low + high) / 2;
+      if (values[piles[mid]] < values[c]) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    if (low > 0) {
+      previous[c] = piles[low - 1];
+    }
+    if (low == piles.size()) {
+      piles.append(c);
+    } else {
+      piles[low] = c;
+    }
+  }
+
+  QVector<int> indices(piles.size());
+  int c = piles.isEmpty() ? -1 : piles.last();
+  for (int i = piles.size() - 1; i >= 0; i--) {
+    indices[i] = c;
+    c = previous[c];
+  }
+  return indices;
+}
+
+
+QList<Diff> diff_match_patch::diff_parallel(const QString &text1,
+    const QString &text2, DiffBudget &budget) {
+  // Split the big ranges exactly as diff_anchored would, in the same order,
+  // so the ranges left are those it would recurse into and their diffs
+  // follow each other in its result.
+  QVector<DiffRange> ranges;
+  QVector<DiffRange> stack;
+  stack.append(DiffRange{0, static_cast<int>(text1.length()),
+                         0, static_cast<int>(text2.length()),
+                         DiffRange::ANCHOR});
+  while (!stack.isEmpty()) {
+    const DiffRange range = stack.takeLast();
+    if (range.kind == DiffRange::ANCHOR && range.start2 < range.end2
+        && range.end1 - range.start1 >= 2 * Diff_ParallelLines) {
+      const QVector<DiffRange> pieces = diff_anchorPieces(text1, text2, range);
+      for (int i = pieces.size() - 1; i >= 0; i--) {
+        stack.append(pieces[i]);
+      }
+    } else {
+      ranges.append(range);
+    }
+  }
+  if (ranges.size() == 1) {
+    return diff_anchored(text1, text2, ranges[0], budget);
+  }
+
+  // Every range is diffed on its own copy of the settings and of the budget.
+  // The sequential diff spends the budget on them one after the other, and
+  // makes the same choices as long as it has some left.
+  struct Part {
+    DiffRange range;
+    QList<Diff> diffs;
+    qint64 spent;
+  };
+  QVector<Part> parts;
+  for (const DiffRange &range : ranges) {
+    parts.append(Part{range, QList<Diff>(), 0});
+  }
+  QtConcurrent::blockingMap(parts, [this, &text1, &text2, &budget](Part &part) {
+    diff_match_patch differ(*this);
+    DiffBudget partBudget = budget;
+    part.diffs = differ.diff_anchored(text1, text2, part.range, partBudget);
+    part.spent = budget.cells - partBudget.cells;
+  });
+
+  qint64 spent = 0;
+  for (const Part &part : parts) {
+    spent += part.spent;
+  }
+  if (spent >= budget.cells) {
+    // One after the other the ranges would have run out of budget, and some
+    // of them fallen back where they did not here.
+    return diff_anchored(text1, text2, budget);
+  }
+
+  budget.cells -= spent;
+  QList<Diff> diffs;
+  for (const Part &part : parts) {
+    diffs += part.diffs;
+  }
+  return diffs;
+}
+
+
+QVector<int> diff_match_patch::diff_histogramAnchors(const QString &text1,
+    const QString &text2, int start1, int end1, int start2, int end2) {
+  // Lines occurring more often than this are too common to anchor on.
+  const int maxChainLength = 64;
+
+  QHash<ushort, QVector<int> > occurrences;
+  for (int x = start1; x < end1; x++) {
+    occurrences[text1[x].unicode()].append(x);
+  }
+
+  QVector<int> anchors;
+  int bestCount = maxChainLength;
+  int bestLength = 0;
+  int y = start2;
+  while (y < end2) {
+    int nextY = y + 1;
+    const auto found = occurrences.constFind(text2[y].unicode());
+    if (found == occurrences.constEnd() || found->size() > bestCount) {
+      y = nextY;
+      continue;
+    }
+    for (const int x : *found) {
+      // Extend the match in both directions.
+      int regionStart1 = x;
+      int regionStart2 = y;
+      while (regionStart1 > start1 && regionStart2 > start2
+          && text1[regionStart1 - 1] == text2[regionStart2 - 1]) {
+        regionStart1--;
+        regionStart2--;
+      }
+      int regionEnd1 = x + 1;
+      int regionEnd2 = y + 1;
+      while (regionEnd1 < end1 && regionEnd2 < end2
+          && text1[regionEnd1] == text2[regionEnd2]) {
+        regionEnd1++;
+        regionEnd2++;
+      }
+
+      int count = maxChainLength + 1;
+      for (int r = regionStart1; r < regionEnd1; r++) {
+        count = std::min(count, static_cast<int>(
+            occurrences.value(text1[r].unicode()).size()));
+      }
+      const int length = regionEnd1 - regionStart1;
+      if (count < bestCount || (count == bestCount && length > bestLength)) {
+        bestCount = count;
+        bestLength = length;
+        anchors = {regionStart1, regionStart2, length};
+      }
+      // Lines within this region have been looked at already.
+      nextY = std::max(nextY, regionEnd2);
+    }
+    y = nextY;
+  }
+  return anchors;
+}
+
 QList<QVariant> diff_match_patch::diff_linesToChars(const QString &text1,
                                                     const QString &text2) {
   QStringList lineArray;
@@ -641,8 +1001,8 @@ int diff_match_patch::diff_commonOverlap(const QString &text1,
 
 QStringList diff_match_patch::diff_halfMatch(const QString &text1,
                                              const QString &text2) {
-  if (Diff_Timeout <= 0) {
-    // Don't risk returning a non-optimal diff if we have unlimited time.
+  if (Diff_Budget <= 0) {
+    // Don't risk returning a non-optimal diff if we have unlimited budget.
     return QStringList();
   }
   const QString longtext = text1.length() > text2.length() ? text1 : text2;
@@ -958,8 +1318,16 @@ int diff_match_patch::diff_cleanupSemanticScore(const QString &one,
   bool whitespace2 = nonAlphaNumeric2 && char2.isSpace();
   bool lineBreak1 = whitespace1 && char1.category() == QChar::Other_Control;
   bool lineBreak2 = whitespace2 && char2.category() == QChar::Other_Control;
-  bool blankLine1 = lineBreak1 && BLANKLINEEND.indexIn(one) != -1;
-  bool blankLine2 = lineBreak2 && BLANKLINESTART.indexIn(two) != -1;
+  // Plain string checks instead of shared regular expressions, which would
+  // not be safe to use from the threads of diff_parallel.
+  bool blankLine1 = lineBreak1
+      && (one.endsWith(QLatin1String("\n\n"))
+          || one.endsWith(QLatin1String("\n\r\n")));
+  bool blankLine2 = lineBreak2
+      && (two.startsWith(QLatin1String("\n\n"))
+          || two.startsWith(QLatin1String("\n\r\n"))
+          || two.startsWith(QLatin1String("\r\n\n"))
+          || two.startsWith(QLatin1String("\r\n\r\n")));
 
   if (blankLine1 || blankLine2) {
     // Five points for blank lines.
@@ -981,11 +1349,6 @@ int diff_match_patch::diff_cleanupSemanticScore(const QString &one,
 }
 
 
-// Define some regex patterns for matching boundaries.
-QRegExp diff_match_patch::BLANKLINEEND = QRegExp("\\n\\r?\\n$");
-QRegExp diff_match_patch::BLANKLINESTART = QRegExp("^\\r?\\n\\r?\\n");
-
-
 void diff_match_patch::diff_cleanupEfficiency(QList<Diff> &diffs) {
   if (diffs.isEmpty()) {
     return;
@@ -71,6 +71,17 @@ enum Operation {
 };
 
 
+/**
+* The algorithm used to line up changed lines when checklines is set.
+* MYERS bisects the line hashes like any other text, PATIENCE and HISTOGRAM
+* anchor on lines that are rare in both texts and only diff the gaps between
+* those anchors.
+*/
+enum DiffAlgorithm {
+  MYERS, PATIENCE, HISTOGRAM
+};
+
+
 /**
 * Class representing one diff operation.
 */
@@ -97,6 +108,21 @@ class Diff {
 };
 
 
+/**
+* Work budget shared by the recursive diff functions.
+*/
+struct DiffBudget {
+  // Number of edit graph cells diff_bisect may still explore.
+  qint64 cells;
+  // Cells left for the line diffs run once cells is spent, shared by every
+  // fallback of one diff so that the budget bounds its total work.
+  qint64 fallbackCells;
+  // Set while diffing line hashes, where there is nothing coarser to fall
+  // back to once the budget runs out.
+  bool lineFallback;
+};
+
+
 /**
 * Class representing one patch operation.
 */
@@ -129,8 +155,22 @@ class diff_match_patch {
   // Defaults.
   // Set these on your diff_match_patch instance to override the defaults.
 
-  // Number of seconds to map a diff before giving up (0 for infinity).
-  float Diff_Timeout;
+  // Number of edit graph cells to explore before falling back to a line
+  // granularity diff (0 for infinity).  The line diffs get one more allowance
+  // of the same size between them, so a diff explores at most twice this
+  // many cells.  Unlike a timeout this keeps the result independent of
+  // machine load.
+  qint64 Diff_Budget;
+  // How changed lines are found when diffing with checklines.
+  DiffAlgorithm Diff_Algorithm;
+  // When PATIENCE or HISTOGRAM line up the lines of two texts, ranges of at
+  // least twice this many lines are split at their anchors and the ranges
+  // between those are diffed concurrently (0 to never split).  These are the
+  // ranges the sequential diff recurses into, and they draw on one
+  // Diff_Budget, so the result is the same.  Should they run out of budget
+  // together, the lines are diffed again one range after the other.  MYERS
+  // never splits.
+  int Diff_ParallelLines;
   // Cost of an empty edit operation in terms of edit characters.
   short Diff_EditCost;
   // At what point is no match declared (0.0 = perfection, 1.0 = very loose).
@@ -150,12 +190,6 @@ class diff_match_patch {
   // The number of bits in an int.
   short Match_MaxBits;
 
- private:
-  // Define some regex patterns for matching boundaries.
-  static QRegExp BLANKLINEEND;
-  static QRegExp BLANKLINESTART;
-
-
  public:
 
   diff_match_patch();
@@ -193,12 +227,12 @@ class diff_match_patch {
    * @param checklines Speedup flag.  If false, then don't run a
    *     line-level diff first to identify the changed areas.
    *     If true, then run a faster slightly less optimal diff.
-   * @param deadline Time when the diff should be complete by.  Used
-   *     internally for recursive calls.  Users should set DiffTimeout instead.
+   * @param budget Work left before the diff falls back to lines.  Used
+   *     internally for recursive calls.  Users should set Diff_Budget instead.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines, clock_t deadline);
+  QList<Diff> diff_main(const QString &text1, const QString &text2, bool checklines, DiffBudget &budget);
 
   /**
    * Find the differences between two texts.  Assumes that the texts do not
@@ -208,11 +242,11 @@ class diff_match_patch {
    * @param checklines Speedup flag.  If false, then don't run a
    *     line-level diff first to identify the changed areas.
    *     If true, then run a faster slightly less optimal diff.
-   * @param deadline Time when the diff should be complete by.
+   * @param budget Work left before the diff falls back to lines.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_compute(QString text1, QString text2, bool checklines, clock_t deadline);
+  QList<Diff> diff_compute(QString text1, QString text2, bool checklines, DiffBudget &budget);
 
   /**
    * Do a quick line-level diff on both strings, then rediff the parts for
@@ -220,11 +254,11 @@ class diff_match_patch {
    * This speedup can produce non-minimal diffs.
    * @param text1 Old string to be diffed.
    * @param text2 New string to be diffed.
-   * @param deadline Time when the diff should be complete by.
+   * @param budget Work left before the diff falls back to lines.
    * @return Linked List of Diff objects.
    */
  private:
-  QList<Diff> diff_lineMode(QString text1, QString text2, clock_t deadline);
+  QList<Diff> diff_lineMode(QString text1, QString text2, DiffBudget &budget);
 
   /**
    * Find the 'middle snake' of a diff, split the problem in two
@@ -232,10 +266,23 @@ class diff_match_patch {
    * See Myers 1986 paper: An O(ND) Difference Algorithm and Its Variations.
    * @param text1 Old string to be diffed.
    * @param text2 New string to be diffed.
+   * @param budget Work left before the diff falls back to lines.
    * @return Linked List of Diff objects.
    */
  protected:
-  QList<Diff> diff_bisect(const QString &text1, const QString &text2, clock_t deadline);
+  QList<Diff> diff_bisect(const QString &text1, const QString &text2, DiffBudget &budget);
+
+  /**
+   * Diff two texts line by line without rediffing the changed lines.  Used
+   * once diff_bisect has exhausted its budget, so that the result degrades
+   * to whole changed lines instead of a single replacement of both texts.
+   * @param text1 Old string to be diffed.
+   * @param text2 New string to be diffed.
+   * @param budget Budget whose fallback allowance the line diff draws from.
+   * @return Linked List of Diff objects.
+   */
+ private:
+  QList<Diff> diff_lineFallback(const QString &text1, const QString &text2, DiffBudget &budget);
 
   /**
    * Given the location of the 'middle snake', split the diff in two parts
@@ -244,11 +291,112 @@ class diff_match_patch {
    * @param text2 New string to be diffed.
    * @param x Index of split point in text1.
    * @param y Index of split point in text2.
-   * @param deadline Time at which to bail if not yet complete.
+   * @param budget Work left before the diff falls back to lines.
    * @return LinkedList of Diff objects.
    */
  private:
-  QList<Diff> diff_bisectSplit(const QString &text1, const QString &text2, int x, int y, clock_t deadline);
+  QList<Diff> diff_bisectSplit(const QString &text1, const QString &text2, int x, int y, DiffBudget &budget);
+
+  /**
+   * A range of two strings of line hashes, as diff_anchored works through
+   * them.
+   */
+ private:
+  struct DiffRange {
+    int start1;
+    int end1;
+    int start2;
+    int end2;
+    // ANCHOR ranges are still to be anchored, BISECT ranges have nothing to
+    // anchor on and go to diff_main, EQUAL ranges are known to match.
+    enum { ANCHOR, BISECT, EQUAL } kind;
+  };
+
+  /**
+   * Diff two strings of line hashes by anchoring on matching lines picked by
+   * Diff_Algorithm and recursing into the gaps between them.  Gaps without
+   * any anchor are handed to diff_main.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param budget Work left before the diff falls back to lines.
+   * @return Linked List of Diff objects.
+   */
+ private:
+  QList<Diff> diff_anchored(const QString &text1, const QString &text2, DiffBudget &budget);
+
+  /**
+   * Diff a range of two strings of line hashes the same way.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param range Range to diff.
+   * @param budget Work left before the diff falls back to lines.
+   * @return Linked List of Diff objects.
+   */
+ private:
+  QList<Diff> diff_anchored(const QString &text1, const QString &text2, const DiffRange &range, DiffBudget &budget);
+
+  /**
+   * Take one step of diff_anchored: trim the common lines off an ANCHOR
+   * range with lines left on both sides and split what is left at its
+   * anchors.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param range Range to split.
+   * @return The pieces of the range, in text order.
+   */
+ private:
+  QVector<DiffRange> diff_anchorPieces(const QString &text1, const QString &text2, const DiffRange &range);
+
+  /**
+   * Diff two strings of line hashes as diff_anchored does, but split ranges
+   * of at least twice Diff_ParallelLines lines the way it would and diff
+   * the ranges left concurrently.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param budget Work left before the diff falls back to lines.
+   * @return Linked List of Diff objects, those diff_anchored returns.
+   */
+ private:
+  QList<Diff> diff_parallel(const QString &text1, const QString &text2, DiffBudget &budget);
+
+  /**
+   * Find the longest strictly increasing subsequence by patience sorting.
+   * @param values Values to search.
+   * @return Indices into values of the subsequence, in increasing order.
+   */
+ private:
+  static QVector<int> diff_longestIncreasing(const QVector<int> &values);
+
+  /**
+   * Find the longest increasing run of lines occurring exactly once in both
+   * ranges, see Bram Cohen's patience diff.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param start1 Start of the range in text1.
+   * @param end1 End of the range in text1.
+   * @param start2 Start of the range in text2.
+   * @param end2 End of the range in text2.
+   * @return Anchors as (index in text1, index in text2, length) triplets.
+   */
+ private:
+  QVector<int> diff_patienceAnchors(const QString &text1, const QString &text2,
+                                    int start1, int end1, int start2, int end2);
+
+  /**
+   * Find the common region whose rarest line occurs the fewest times in the
+   * old range, preferring longer regions on ties, like git's histogram diff.
+   * Lines occurring more than 64 times are never used as anchors.
+   * @param text1 Old string of line hashes.
+   * @param text2 New string of line hashes.
+   * @param start1 Start of the range in text1.
+   * @param end1 End of the range in text1.
+   * @param start2 Start of the range in text2.
+   * @param end2 End of the range in text2.
+   * @return The anchor as an (index in text1, index in text2, length) triplet.
+   */
+ private:
+  QVector<int> diff_histogramAnchors(const QString &text1, const QString &text2,
+                                     int start1, int end1, int start2, int end2);
 
   /**
    * Split two texts into a list of strings.  Reduce the texts to a string of
@@ -0,0 +1,228 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QJsonObject>
+#include <QStringView>
+#include <QVector>
+
+#include <qmljs/parser/qmljsengine_p.h>
+#include <qmljs/parser/qmljslexer_p.h>
+
+#include <diff_match_patch.h>
+#include "editscript.h"
+
+// How many tokens either side may skip to get back in step with the other, e.g. over an added semicolon.
+static const int MaxTokenDrift = 4;
+
+struct SourceToken
+{
+    int offset;
+    int length;
+    int kind;
+};
+
+static bool Tokenize(const QString& text, bool qmlMode, QVector<SourceToken>& tokens)
+{
+    QmlJS::Engine engine;
+    QmlJS::Lexer lexer(&engine);
+    lexer.setCode(text, 1, qmlMode);
+
+    for (int kind = lexer.lex(); kind != QmlJS::Lexer::EOF_SYMBOL; kind = lexer.lex())
+    {
+        if (kind == QmlJS::Lexer::T_ERROR)
+            return false;
+
+        tokens.append({ lexer.tokenOffset(), lexer.tokenLength(), kind });
+    }
+
+    return true;
+}
+
+static bool SameToken(const QString& source, const SourceToken& token, const QString& reformatted, const SourceToken& newToken)
+{
+    return token.kind == newToken.kind
+        && QStringView(source).mid(token.offset, token.length) == QStringView(reformatted).mid(newToken.offset, newToken.length);
+}
+
+static void AddEdit(const QString& source, int start, int end, const QString& reformatted, int newStart, int newEnd, QList<TextEdit>& edits)
+{
+    const QStringView gap = QStringView(source).mid(start, end - start);
+    const QStringView newGap = QStringView(reformatted).mid(newStart, newEnd - newStart);
+    if (gap == newGap)
+        return;
+
+    int prefix = 0;
+    while (prefix < gap.size() && prefix < newGap.size() && gap[prefix] == newGap[prefix])
+        prefix++;
+
+    int suffix = 0;
+    while (suffix < gap.size() - prefix && suffix < newGap.size() - prefix
+        && gap[gap.size() - suffix - 1] == newGap[newGap.size() - suffix - 1])
+        suffix++;
+
+    const int length = static_cast<int>(gap.size()) - prefix - suffix;
+    edits.append({ start + prefix, length, newGap.mid(prefix, newGap.size() - prefix - suffix).toString() });
+}
+
+bool EditScript::FromTokens(const QString& source, const QString& reformatted, bool qmlMode, QList<TextEdit>& edits)
+{
+    edits.clear();
+
+    QVector<SourceToken> tokens;
+    QVector<SourceToken> newTokens;
+    if (!Tokenize(source, qmlMode, tokens) || !Tokenize(reformatted, qmlMode, newTokens))
+        return false;
+
+    int i = 0;
+    int j = 0;
+    int end = 0;
+    int newEnd = 0;
+    while (i < tokens.size() && j < newTokens.size())
+    {
+        if (!SameToken(source, tokens[i], reformatted, newTokens[j]))
+        {
+            // Skip the fewest tokens that bring the streams back in step, the skipped tokens become part of the gap.
+            bool inStep = false;
+            for (int drift = 1; drift <= MaxTokenDrift && !inStep; drift++)
+            {
+                for (int skip = 0; skip <= drift && !inStep; skip++)
+                {
+                    const int nextI = i + skip;
+                    const int nextJ = j + drift - skip;
+                    if (nextI < tokens.size() && nextJ < newTokens.size()
+                        && SameToken(source, tokens[nextI], reformatted, newTokens[nextJ]))
+                    {
+                        i = nextI;
+                        j = nextJ;
+                        inStep = true;
+                    }
+                }
+            }
+
+            if (!inStep)
+                return false;
+        }
+
+        AddEdit(source, end, tokens[i].offset, reformatted, newEnd, newTokens[j].offset, edits);
+        end = tokens[i].offset + tokens[i].length;
+        newEnd = newTokens[j].offset + newTokens[j].length;
+        i++;
+        j++;
+    }
+
+    // Tokens left over on either side can only be a stray few at the very end.
+    if (tokens.size() - i > MaxTokenDrift || newTokens.size() - j > MaxTokenDrift)
+        return false;
+
+    AddEdit(source, end, source.length(), reformatted, newEnd, reformatted.length(), edits);
+    return true;
+}
+
+QList<Diff> EditScript::ToDiffs(const QString& source, const QList<TextEdit>& edits)
+{
+    QList<Diff> diffs;
+    int position = 0;
+    for (const TextEdit& edit : edits)
+    {
+        if (edit.offset > position)
+            diffs.append(Diff(EQUAL, source.mid(position, edit.offset - position)));
+        if (edit.length > 0)
+            diffs.append(Diff(DELETE, source.mid(edit.offset, edit.length)));
+        if (!edit.replacement.isEmpty())
+            diffs.append(Diff(INSERT, edit.replacement));
+
+        position = edit.offset + edit.length;
+    }
+
+    if (position < source.length())
+        diffs.append(Diff(EQUAL, source.mid(position)));
+
+    return diffs;
+}
+
+QList<TextEdit> EditScript::FromDiffs(const QList<Diff>& diffs)
+{
+    QList<TextEdit> edits;
+    int position = 0;
+    bool inEdit = false;
+    for (const Diff& diff : diffs)
+    {
+        if (diff.operation == EQUAL)
+        {
+            position += diff.text.length();
+            inEdit = false;
+            continue;
+        }
+
+        if (!inEdit)
+            edits.append({ position, 0, QString() });
+        inEdit = true;
+
+        if (diff.operation == DELETE)
+        {
+            edits.last().length += diff.text.length();
+            position += diff.text.length();
+        }
+        else
+        {
+            edits.last().replacement += diff.text;
+        }
+    }
+
+    return edits;
+}
+
+QJsonArray EditScript::ToJson(const QString& source, const QList<TextEdit>& edits)
+{
+    QJsonArray array;
+    int position = 0;
+    int line = 1;
+    int lineStart = 0;
+    for (const TextEdit& edit : edits)
+    {
+        // Edits are ordered, so lines only need to be counted up to each edit once.
+        for (; position < edit.offset; position++)
+        {
+            if (source[position] == '\n')
+            {
+                line++;
+                lineStart = position + 1;
+            }
+        }
+
+        QJsonObject object;
+        object["offset"] = edit.offset;
+        object["length"] = edit.length;
+        object["line"] = line;
+        object["column"] = edit.offset - lineStart + 1;
+        object["replacement"] = edit.replacement;
+        array.append(object);
+    }
+
+    return array;
+}
@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QJsonArray>
+#include <QList>
+#include <QString>
+
+class Diff;
+
+// Replacement of a range of the source by new text. Offsets and lengths are in UTF-16 code units.
+struct TextEdit
+{
+    int offset;
+    int length;
+    QString replacement;
+};
+
+class EditScript
+{
+public:
+    // The reformatter keeps the tokens of a document and only rewrites the whitespace and comments between them,
+    // adding or dropping the odd semicolon. Aligns the tokens of source and reformatted and lists the changed gaps,
+    // trimmed to the characters that actually differ. Runs in linear time, but returns false if the token streams
+    // cannot be brought back in step, in which case a real diff is needed.
+    static bool FromTokens(const QString& source, const QString& reformatted, bool qmlMode, QList<TextEdit>& edits);
+
+    // Converts edits, ordered by offset, to the diff they describe.
+    static QList<Diff> ToDiffs(const QString& source, const QList<TextEdit>& edits);
+
+    // Converts a diff to the edits it describes, one per run of deletions and insertions.
+    static QList<TextEdit> FromDiffs(const QList<Diff>& diffs);
+
+    // Lists edits, ordered by offset, as JSON objects holding offset, length and replacement, along with the
+    // 1-based line and column the edit starts at in the source.
+    static QJsonArray ToJson(const QString& source, const QList<TextEdit>& edits);
+};
@@ -0,0 +1,191 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QDir>
+#include <QFileInfo>
+#include <QHash>
+#include <QProcess>
+
+#include "git.h"
+
+bool Git::Run(const QStringList& arguments, const QByteArray& input, QByteArray& output, QString& error,
+    const QString& workingDirectory)
+{
+    QProcess git;
+    git.setWorkingDirectory(workingDirectory);
+    git.start("git", arguments);
+    if (!git.waitForStarted())
+    {
+        error = "Could not run git: " + git.errorString() + "\n";
+        return false;
+    }
+
+    git.write(input);
+    git.closeWriteChannel();
+    git.waitForFinished(-1);
+    output = git.readAllStandardOutput();
+    if (git.exitStatus() != QProcess::NormalExit || git.exitCode() != 0)
+    {
+        error = "git " + arguments.first() + " failed: " + QString::fromLocal8Bit(git.readAllStandardError());
+        return false;
+    }
+
+    return true;
+}
+
+QString Git::TopLevel(QString& error)
+{
+    QByteArray output;
+    if (!Run({ "rev-parse", "--show-toplevel" }, QByteArray(), output, error))
+        return QString();
+
+    return QString::fromLocal8Bit(output.trimmed());
+}
+
+bool Git::StagedFiles(const QStringList& paths, QList<StagedFile>& files, QString& error)
+{
+    const QString topLevel = TopLevel(error);
+    if (topLevel.isEmpty())
+        return false;
+
+    // Entries are ":<old mode> <new mode> <old id> <new id> <status>", then the path, or the old and new path
+    // for copies and renames, all separated by NUL
+    QByteArray output;
+    if (!Run(QStringList{ "diff", "--cached", "--raw", "--no-abbrev", "-z", "--diff-filter=ACMR", "--" } + paths, QByteArray(), output, error))
+        return false;
+
+    const QList<QByteArray> fields = output.split('\0');
+    QList<QByteArray> ids;
+    const QDir topDir(topLevel);
+    for (int i = 0; i + 1 < fields.count(); i += 2)
+    {
+        const QList<QByteArray> entry = fields[i].split(' ');
+        if (entry.count() != 5)
+            break;
+
+        if (entry[4].startsWith('C') || entry[4].startsWith('R'))
+            i++;
+
+        // Only regular QML files have a blob to format, submodules and symbolic links are left alone
+        if ((entry[1] != "100644" && entry[1] != "100755") || !fields[i + 1].endsWith(".qml"))
+            continue;
+
+        StagedFile file;
+        file.path = QString::fromUtf8(fields[i + 1]);
+        file.fileName = QDir::current().relativeFilePath(topDir.filePath(file.path));
+        files.append(file);
+        ids.append(entry[3]);
+    }
+
+    // Blobs come back as "<id> blob <size>", a newline, the content and another newline
+    QByteArray blobs;
+    if (!Run({ "cat-file", "--batch" }, ids.join('\n') + '\n', blobs, error))
+        return false;
+
+    qsizetype position = 0;
+    for (StagedFile& file : files)
+    {
+        const qsizetype headerEnd = blobs.indexOf('\n', position);
+        const QList<QByteArray> header = blobs.mid(position, headerEnd - position).split(' ');
+        if (headerEnd < 0 || header.count() != 3)
+        {
+            error = "git cat-file returned no content for " + file.fileName + "\n";
+            return false;
+        }
+
+        const qsizetype size = header[2].toLongLong();
+        file.content = blobs.mid(headerEnd + 1, size);
+        position = headerEnd + 1 + size + 1;
+    }
+
+    return true;
+}
+
+bool Git::ChangedFiles(const QString& ref, const QStringList& paths, QStringList& files, QString& error)
+{
+    const QString topLevel = TopLevel(error);
+    if (topLevel.isEmpty())
+        return false;
+
+    QByteArray base;
+    if (!Run({ "merge-base", ref, "HEAD" }, QByteArray(), base, error))
+        return false;
+
+    QByteArray output;
+    if (!Run(QStringList{ "diff", "--name-only", "-z", "--diff-filter=AMR", QString::fromLatin1(base.trimmed()), "--" } + paths,
+        QByteArray(), output, error))
+        return false;
+
+    // Canonical paths, as the current directory may be reached through a symbolic link, files deleted since do not count
+    const QDir topDir(topLevel);
+    for (const QByteArray& path : output.split('\0'))
+    {
+        const QString file = QFileInfo(topDir.filePath(QString::fromUtf8(path))).canonicalFilePath();
+        if (!path.isEmpty() && !file.isEmpty())
+            files.append(file);
+    }
+
+    return true;
+}
+
+bool Git::Stage(const QList<StagedFile>& files, QString& error)
+{
+    const QString topLevel = TopLevel(error);
+    if (topLevel.isEmpty())
+        return false;
+
+    // The mode of every file as staged, from lines of "<mode> <id> <stage>\t<path>"
+    QStringList paths;
+    for (const StagedFile& file : files)
+        paths.append(file.path);
+
+    QByteArray output;
+    if (!Run(QStringList{ "ls-files", "--stage", "-z", "--" } + paths, QByteArray(), output, error, topLevel))
+        return false;
+
+    QHash<QString, QByteArray> modes;
+    for (const QByteArray& line : output.split('\0'))
+    {
+        const qsizetype tab = line.indexOf('\t');
+        if (tab > 0)
+            modes.insert(QString::fromUtf8(line.mid(tab + 1)), line.left(line.indexOf(' ')));
+    }
+
+    // Write the new content as blobs and point the index at them, all in one update
+    QByteArray indexInfo;
+    for (const StagedFile& file : files)
+    {
+        QByteArray id;
+        if (!Run({ "hash-object", "-w", "--no-filters", "--stdin" }, file.content, id, error, topLevel))
+            return false;
+
+        indexInfo += modes.value(file.path, "100644") + ' ' + id.trimmed() + '\t' + file.path.toUtf8() + '\0';
+    }
+
+    return Run({ "update-index", "-z", "--index-info" }, indexInfo, output, error, topLevel);
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+// Reads and updates the git repository the current directory is in, through the git command line.
+class Git
+{
+public:
+    // A file as staged in the index.
+    struct StagedFile
+    {
+        // Path relative to the top of the repository, as the index knows it
+        QString path;
+
+        // Path relative to the current directory, for messages
+        QString fileName;
+
+        QByteArray content;
+    };
+
+    // Reads the files added, copied, modified or renamed in the index compared to HEAD, limited to paths if any
+    // are given. All their content is read by a single git cat-file process.
+    static bool StagedFiles(const QStringList& paths, QList<StagedFile>& files, QString& error);
+
+    // Canonical paths of the files added, modified or renamed since the merge base of ref and HEAD, including
+    // changes not committed yet, limited to paths if any are given.
+    static bool ChangedFiles(const QString& ref, const QStringList& paths, QStringList& files, QString& error);
+
+    // Replaces the content of files in the index, keeping their mode.
+    static bool Stage(const QList<StagedFile>& files, QString& error);
+
+private:
+    static QString TopLevel(QString& error);
+    static bool Run(const QStringList& arguments, const QByteArray& input, QByteArray& output, QString& error,
+        const QString& workingDirectory = QString());
+};
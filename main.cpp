@@ -46,6 +46,32 @@ int ParseIntOption(QCommandLineParser &parser, QCommandLineOption &option)
     return optionValue;
 }
 
+qint64 ParseSizeOption(QCommandLineParser &parser, QCommandLineOption &option)
+{
+    // A number of bytes, optionally followed by K, M or G
+    QString value = parser.value(option).trimmed().toUpper();
+    qint64 unit = 1;
+    if (value.endsWith('K'))
+        unit = Q_INT64_C(1) << 10;
+    else if (value.endsWith('M'))
+        unit = Q_INT64_C(1) << 20;
+    else if (value.endsWith('G'))
+        unit = Q_INT64_C(1) << 30;
+
+    if (unit != 1)
+        value.chop(1);
+
+    bool ok = true;
+    qint64 optionValue = value.toLongLong(&ok) * unit;
+    if (!ok || optionValue < 0)
+    {
+        QTextStream(stderr) << "Invalid value for option " << option.names().last() << "\n";
+        optionValue = -1;
+    }
+
+    return optionValue;
+}
+
 void SetupVersionInfo(QCoreApplication &app)
 {
     app.setApplicationName("qmlfmt");
@@ -84,9 +110,62 @@ int main(int argc, char *argv[])
         "If a file\'s formatting is different from qmlfmt\'s, overwrite it "
         "with qmlfmt\'s version.");
 
+    QCommandLineOption editsOption(QStringList() << "edits",
+        "Do not print reformatted sources to standard output. "
+        "Print the edits turning each file into qmlfmt\'s version to standard output, "
+        "one line per file. The only supported format is json.", "format");
+
+    QCommandLineOption syntaxCheckOption(QStringList() << "syntax-check",
+        "Do not format, only parse the sources and print their errors.");
+
     QCommandLineOption indentSizeOption(QStringList() << "i" << "indent", "How many spaces to use for indentation", "indent", "4");
     QCommandLineOption tabSizeOption(QStringList() << "t" << "tab-size", "How many spaces to replace tabs with", "tab size", "4");
     QCommandLineOption lineLengthOption(QStringList() << "b" << "line-length", "How many characters before line will be broken.", "line length", "80");
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", "How many files to format in parallel, 0 for one per core.", "jobs", "0");
+    QCommandLineOption maxMemoryOption(QStringList() << "max-memory",
+        "Memory budget for the files formatted at once and their unprinted output, e.g. 2G, 0 for no limit. "
+        "Defaults to three quarters of the memory the container allows.", "bytes");
+    QCommandLineOption workersOption(QStringList() << "workers",
+        "Format files in this many separate processes, so a file crashing qmlfmt, or hanging it past --file-timeout, only fails that file.", "workers");
+    QCommandLineOption workerOption(QStringList() << "worker", "Run as a worker process for --workers.");
+    workerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    QCommandLineOption fileTimeoutOption(QStringList() << "file-timeout",
+        "Give up on files taking longer than this many milliseconds to format, 0 for no limit. "
+        "They are reported as errors and left as they are. "
+        "Files are formatted in one worker process per job to stop them in time, unless --workers is given.", "milliseconds", "0");
+    QCommandLineOption captureSlowOption(QStringList() << "capture-slow",
+        "Copy files taking longer than this many milliseconds to parse or reformat into the --capture-dir directory, "
+        "along with a JSON file holding the options, timings, size and version used, how formatting ended and in "
+        "how many chunks. "
+        "Files a worker was stopped or crashed on are copied too.", "milliseconds");
+    QCommandLineOption captureDirOption(QStringList() << "capture-dir",
+        "Directory --capture-slow copies slow files to.", "dir", "qmlfmt-slow");
+    QCommandLineOption gitStagedOption(QStringList() << "git-staged",
+        "Format the qml files staged in git instead of those on disk, limited to the given paths if any. "
+        "With -w the index is updated, the files on disk are left as they are.");
+    QCommandLineOption changedSinceOption(QStringList() << "changed-since",
+        "Only format the files added, modified or renamed since the merge base of this git ref and HEAD. "
+        "Without a path, the current directory is processed instead of the standard input.", "ref");
+    QCommandLineOption watchOption(QStringList() << "watch",
+        "Format the qml files in a directory, then keep formatting the ones that change until stopped.", "dir");
+    QCommandLineOption stampsOption(QStringList() << "stamps",
+        "Mark files -l and -w found or made formatted in an extended attribute, "
+        "and skip them without reading them while they are unchanged.");
+    QCommandLineOption streamThresholdOption(QStringList() << "stream-threshold",
+        "Format qml files of at least this size chunk by chunk on all cores when printing or overwriting them, "
+        "e.g. 64M, so memory use stays bounded however big they are and big files do not wait on one core. "
+        "Defaults to 1M. -l checks files of 64K or more chunk by chunk up to their first change, leaving syntax errors "
+        "after it unreported. 0 formats and checks every file as a whole.", "bytes", "1M");
+    QCommandLineOption shardOption(QStringList() << "shard",
+        "Only format the files in shard i of n, numbered from 0, picked by a hash of their path in the repository. "
+        "Running every shard formats every file exactly once.", "i/n");
+    QCommandLineOption costHistoryOption(QStringList() << "cost-history",
+        "Remember how long each file took to format in this file, and start the slowest files first in later runs.", "file");
+    QCommandLineOption diffBudgetOption(QStringList() << "diff-budget",
+        "How many edit graph cells -d may explore before it settles for a line based diff (0 for no limit).", "cells", "50000000");
+    QCommandLineOption diffAlgorithmOption(QStringList() << "diff-algorithm",
+        "How -d finds changes: tokens, myers, patience or histogram. "
+        "tokens lines up the tokens of the source and the result and falls back to myers if that fails.", "algorithm", "tokens");
 
 
     QMultiMap<QmlFmt::Option, QCommandLineOption> optionMap = {
@@ -94,9 +173,27 @@ int main(int argc, char *argv[])
         { QmlFmt::Option::ListFileName, listOption },
         { QmlFmt::Option::PrintError, errorOption },
         { QmlFmt::Option::OverwriteFile, overwriteOption },
+        { QmlFmt::Option::PrintEdits, editsOption },
+        { QmlFmt::Option::SyntaxCheck, syntaxCheckOption },
         { QmlFmt::Option::None, indentSizeOption},
         { QmlFmt::Option::None, tabSizeOption},
-        { QmlFmt::Option::None, lineLengthOption}
+        { QmlFmt::Option::None, lineLengthOption},
+        { QmlFmt::Option::None, jobsOption},
+        { QmlFmt::Option::None, costHistoryOption},
+        { QmlFmt::Option::None, maxMemoryOption},
+        { QmlFmt::Option::None, workersOption},
+        { QmlFmt::Option::None, shardOption},
+        { QmlFmt::Option::None, fileTimeoutOption},
+        { QmlFmt::Option::None, captureSlowOption},
+        { QmlFmt::Option::None, captureDirOption},
+        { QmlFmt::Option::None, stampsOption},
+        { QmlFmt::Option::None, streamThresholdOption},
+        { QmlFmt::Option::None, watchOption},
+        { QmlFmt::Option::None, gitStagedOption},
+        { QmlFmt::Option::None, changedSinceOption},
+        { QmlFmt::Option::None, workerOption},
+        { QmlFmt::Option::None, diffBudgetOption},
+        { QmlFmt::Option::None, diffAlgorithmOption}
     };
 
     // set up options
@@ -109,35 +206,140 @@ int main(int argc, char *argv[])
     parser.process(app);
 
     // validate arguments
-    if ((parser.isSet(overwriteOption) || parser.isSet(listOption)) && parser.positionalArguments().count() == 0)
+    if ((parser.isSet(overwriteOption) || parser.isSet(listOption)) && parser.positionalArguments().count() == 0 &&
+        !parser.isSet(workerOption) && !parser.isSet(watchOption) && !parser.isSet(gitStagedOption) &&
+        !parser.isSet(changedSinceOption))
     {
         QTextStream(stderr) << "Cannot combine -" << overwriteOption.names().last() << " and -" << listOption.names().last()
             << " with standard input\n";
         return 1;
     }
-    else if (parser.isSet(diffOption) + parser.isSet(overwriteOption) + parser.isSet(listOption) > 1)
+    else if (parser.isSet(diffOption) + parser.isSet(overwriteOption) + parser.isSet(listOption) + parser.isSet(editsOption) +
+        parser.isSet(syntaxCheckOption) > 1)
+    {
+        QTextStream(stderr) << "-" << diffOption.names().last() << ", -" << overwriteOption.names().last() << ", -" <<
+            listOption.names().last() << ", --" << editsOption.names().last() << " and --" << syntaxCheckOption.names().last() <<
+            " are mutually exclusive\n";
+        return 1;
+    }
+    else if (parser.isSet(watchOption) && parser.positionalArguments().count() != 0)
+    {
+        QTextStream(stderr) << "Cannot combine --" << watchOption.names().last() << " with paths\n";
+        return 1;
+    }
+    else if (parser.isSet(editsOption) && parser.value(editsOption) != "json")
     {
-        QTextStream(stderr) << "-" << diffOption.names().last() << ", -" << overwriteOption.names().last() << " and -" <<
-            listOption.names().last() << " are mutually exclusive\n";
+        QTextStream(stderr) << "Invalid value for option " << editsOption.names().last() << "\n";
         return 1;
     }
 
     int indentSize = ParseIntOption(parser, indentSizeOption);
     int tabSize = ParseIntOption(parser, tabSizeOption);
     int lineLength = ParseIntOption(parser, lineLengthOption);
+    int diffBudget = ParseIntOption(parser, diffBudgetOption);
+    int jobs = ParseIntOption(parser, jobsOption);
+    int workers = parser.isSet(workersOption) ? ParseIntOption(parser, workersOption) : 0;
+    int fileTimeout = ParseIntOption(parser, fileTimeoutOption);
+    int captureSlow = parser.isSet(captureSlowOption) ? ParseIntOption(parser, captureSlowOption) : 0;
 
-    if (tabSize < 0 || indentSize < 0)
+    if (tabSize < 0 || indentSize < 0 || diffBudget < 0 || jobs < 0 || workers < 0 || fileTimeout < 0 || captureSlow < 0)
     {
         return 1;
     }
 
+    // Only a worker can be stopped in the middle of a file
+    if (fileTimeout > 0 && !parser.isSet(workersOption) && !parser.isSet(workerOption))
+        workers = -1;
+
+    const QMap<QString, QmlFmt::DiffAlgorithm> diffAlgorithms = {
+        { "tokens", QmlFmt::DiffAlgorithm::Tokens },
+        { "myers", QmlFmt::DiffAlgorithm::Myers },
+        { "patience", QmlFmt::DiffAlgorithm::Patience },
+        { "histogram", QmlFmt::DiffAlgorithm::Histogram }
+    };
+
+    if (!diffAlgorithms.contains(parser.value(diffAlgorithmOption)))
+    {
+        QTextStream(stderr) << "Invalid value for option " << diffAlgorithmOption.names().last() << "\n";
+        return 1;
+    }
+
+    int shardIndex = 0;
+    int shardCount = 1;
+    if (parser.isSet(shardOption))
+    {
+        const QStringList shard = parser.value(shardOption).split('/');
+        bool indexOk = false, countOk = false;
+        if (shard.count() == 2)
+        {
+            shardIndex = shard[0].toInt(&indexOk);
+            shardCount = shard[1].toInt(&countOk);
+        }
+
+        if (!indexOk || !countOk || shardCount < 1 || shardIndex < 0 || shardIndex >= shardCount)
+        {
+            QTextStream(stderr) << "Invalid value for option " << shardOption.names().last() << "\n";
+            return 1;
+        }
+    }
+
     QmlFmt::Options options;
+    QStringList workerArguments = { "--" + workerOption.names().last() };
     for (auto kvp = optionMap.constKeyValueBegin(); kvp != optionMap.constKeyValueEnd(); ++kvp)
     {
-        if (parser.isSet((*kvp).second))
+        const QCommandLineOption& option = (*kvp).second;
+        if (parser.isSet(option))
+        {
             options |= (*kvp).first;
+
+            // Workers format with the same options, scheduling is left to the parent process
+            const QString name = option.names().last();
+            if (name != jobsOption.names().last() && name != maxMemoryOption.names().last() && name != costHistoryOption.names().last() &&
+                name != shardOption.names().last() && name != watchOption.names().last() &&
+                name != gitStagedOption.names().last() && name != changedSinceOption.names().last() &&
+                name != workersOption.names().last() && name != workerOption.names().last())
+            {
+                workerArguments.append("--" + name);
+                if (!option.valueName().isEmpty())
+                    workerArguments.append(parser.value(option));
+            }
+        }
+    }
+
+    QmlFmt qmlFmt(options, indentSize, tabSize, lineLength, diffBudget, diffAlgorithms.value(parser.value(diffAlgorithmOption)));
+    qmlFmt.SetJobs(jobs);
+    qmlFmt.SetCostHistory(parser.value(costHistoryOption));
+    qmlFmt.SetWorkers(workers, workerArguments);
+    qmlFmt.SetShard(shardIndex, shardCount);
+    qmlFmt.SetFileTimeout(fileTimeout);
+    qmlFmt.SetCaptureSlow(captureSlow, parser.value(captureDirOption));
+    qmlFmt.SetStamps(parser.isSet(stampsOption));
+    qmlFmt.SetChangedSince(parser.value(changedSinceOption));
+    if (parser.isSet(maxMemoryOption))
+    {
+        qint64 maxMemory = ParseSizeOption(parser, maxMemoryOption);
+        if (maxMemory < 0)
+            return 1;
+
+        qmlFmt.SetMaxMemory(maxMemory);
     }
 
-    QmlFmt qmlFmt(options, indentSize, tabSize, lineLength);
+    qint64 streamThreshold = ParseSizeOption(parser, streamThresholdOption);
+    if (streamThreshold < 0)
+        return 1;
+
+    qmlFmt.SetStreamThreshold(streamThreshold);
+    if (parser.isSet(workerOption))
+        return qmlFmt.RunWorker();
+
+    if (parser.isSet(watchOption))
+        return qmlFmt.Watch(parser.value(watchOption));
+
+    if (parser.isSet(gitStagedOption))
+        return qmlFmt.RunStaged(parser.positionalArguments());
+
+    if (parser.isSet(changedSinceOption) && parser.positionalArguments().isEmpty())
+        return qmlFmt.Run(QStringList{ "." });
+
     return qmlFmt.Run(parser.positionalArguments());
 }
@@ -30,7 +30,32 @@
 #include <QFileInfo>
 #include <QDir>
 #include <QDirIterator>
+#include <QFileSystemWatcher>
 #include <QRegExp>
+#include <QSaveFile>
+#include <QTemporaryFile>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QScopeGuard>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QBuffer>
+#include <QDataStream>
+#include <QProcess>
+#include <QPromise>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+#include <QtConcurrent>
+#include <QUrl>
+#include <QWaitCondition>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <numeric>
+#include <utility>
 
 #include <qmljs/parser/qmljsengine_p.h>
 #include <qmljs/qmljsdocument.h>
@@ -38,45 +63,162 @@
 #include <qmljs/qmljsreformatter.h>
 
 #include <diff_match_patch.h>
+#include "costhistory.h"
+#include "editscript.h"
+#include "git.h"
+#include "resources.h"
+#include "sinks.h"
+#include "stamps.h"
 #include "qmlfmt.h"
 
 // Listing files with incorrect formatting, overwriting files with formatted content and printing diffs generate no output when files are identical.
 static const QmlFmt::Options SkipIdenticalFilesMask = QmlFmt::Option::ListFileName | QmlFmt::Option::OverwriteFile | QmlFmt::Option::PrintDiff;
 
-int QmlFmt::InternalRun(QIODevice& input, const QString& path)
+// Listing and overwriting files can skip files stamped as formatted, their result would be empty.
+static const QmlFmt::Options StampedFilesMask = QmlFmt::Option::ListFileName | QmlFmt::Option::OverwriteFile;
+
+// Small files are formatted in batches of up to this many nanoseconds of estimated work,
+// so that scheduling them does not take longer than formatting them.
+static const qint64 MaxBatchCost = 5000000;
+
+// Estimated memory needed to format a file, per byte of it: the raw bytes, the UTF-16 source, the AST, the
+// reformatted text and its UTF-8 copy.
+static const qint64 FootprintPerByte = 16;
+
+// Files formatted in chunks are split into chunks of at least an eighth of the stream threshold, up to this
+// many bytes, so that the skeleton around every chunk stays small next to it.
+static const qint64 MaxStreamChunk = 1 << 20;
+
+// -l checks files of at least this many bytes a quarter at a time, and stops at the first quarter that changes,
+// unless the stream threshold is 0.
+static const qint64 ListChunkThreshold = 1 << 16;
+static const int ListChunks = 4;
+
+// Files formatted in chunks give each core several chunks of at least this many bytes to balance the load with.
+static const qint64 MinParallelChunk = 1 << 14;
+
+// How many characters of formatted members are kept for reuse across the files of a run.
+static const qint64 MaxChunkCache = 1 << 24;
+
+// Formatted files are copied to standard output in blocks of this many bytes.
+static const qint64 CopyBlockSize = 1 << 16;
+
+// Watch mode waits until files have not changed for this many milliseconds, so a burst of saves is
+// formatted once.
+static const int WatchDebounce = 200;
+
+// Diffs lining up lines with patience or histogram split ranges of at least twice this many lines at their anchors, and
+// compute the ranges between them on up to --jobs cores.
+static const int ParallelDiffLines = 5000;
+
+// The root of the repository the current directory is in, or the current directory outside of one.
+static QDir RepositoryRoot()
+{
+    for (QDir dir = QDir::current(); ; )
+    {
+        if (dir.exists(".git"))
+            return dir;
+
+        if (!dir.cdUp())
+            return QDir::current();
+    }
+}
+
+// FNV-1a, which unlike qHash is the same on every machine and in every run.
+static quint64 StableHash(const QByteArray& data)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    for (char c : data)
+    {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= Q_UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
+static DiffAlgorithm ToDiffMatchPatch(QmlFmt::DiffAlgorithm algorithm)
+{
+    switch (algorithm)
+    {
+    case QmlFmt::DiffAlgorithm::Patience:
+        return PATIENCE;
+    case QmlFmt::DiffAlgorithm::Histogram:
+        return HISTOGRAM;
+    default:
+        return MYERS;
+    }
+}
+
+QmlFmt::Result QmlFmt::InternalRun(QIODevice& input, const QString& path, const QElapsedTimer& timer, qint64 deduplicateSize,
+    const QList<qint64>& stampTimes) const
 {
-    QTextStream qstdout(stdout);
-    QTextStream qstderr(stderr);
+    Result result;
+    QTextStream qstdout(&result.output);
+    QTextStream qstderr(&result.errors);
     const Utils::FilePath filePath = Utils::FilePath::fromString(path);
-    const QString source = QString::fromUtf8(input.readAll());
+    const QByteArray content = input.readAll();
+    const QString source = QString::fromUtf8(content);
+    result.size = content.size();
+    if (!m_costHistory.isEmpty())
+        result.hash = QCryptographicHash::hash(content, QCryptographicHash::Sha1);
+
     const QmlJS::Dialect dialect = QmlJS::ModelManagerInterface::guessLanguageOfFile(filePath);
 
-    QmlJS::Document::MutablePtr document = QmlJS::Document::create(filePath, dialect);
-    document->setSource(source);
-    document->parse();
-    if (!document->diagnosticMessages().isEmpty())
+    // Files with the same content in the same language format the same, so only the first of them is
+    // formatted and the others wait for its result. They are looked up among the files of deduplicateSize
+    // bytes, -1 formats the file on its own.
+    Formatted formatted;
+    if (deduplicateSize >= 0)
     {
-        if (this->m_options.testFlag(Option::PrintError))
+        const QByteArray key = QByteArray::number(int(dialect.dialect())) + ':' + QCryptographicHash::hash(content, QCryptographicHash::Sha1);
+        QMutexLocker locker(&m_formattedMutex);
+        QHash<QByteArray, QFuture<Formatted>>& twins = m_formatted[deduplicateSize];
+        const auto twin = twins.constFind(key);
+        if (twin != twins.constEnd())
         {
-            for (const QmlJS::DiagnosticMessage& msg : document->diagnosticMessages())
-            {
-                qstderr << (msg.isError() ? "Error:" : "Warning:");
-
-                qstderr << msg.loc.startLine << ':' << msg.loc.startColumn << ':';
-
-                qstderr << ' ' << msg.message << "\n";
-            }
+            const QFuture<Formatted> future = *twin;
+            locker.unlock();
+            formatted = future.result();
+        }
+        else
+        {
+            QPromise<Formatted> promise;
+            promise.start();
+            twins.insert(key, promise.future());
+            locker.unlock();
+            formatted = Format(content, source, path, dialect, timer);
+            result.measured = true;
+            promise.addResult(formatted);
+            promise.finish();
         }
-        return 1;
+    }
+    else
+    {
+        formatted = Format(content, source, path, dialect, timer);
+        result.measured = true;
     }
 
-    const QString reformatted = QmlJS::reformat(document, m_indentSize, m_tabSize, m_lineLength);
+    if (formatted.timedOut)
+        qstderr << "Timed out formatting " << path << " after " << timer.elapsed() << " ms\n";
+
+    qstderr << formatted.errors;
+    result.returnValue = formatted.returnValue;
+    if (result.returnValue != 0 || this->m_options.testFlag(Option::SyntaxCheck))
+        return result;
+
+    const QString& reformatted = formatted.reformatted;
 
     // Only continue if we are printing to stdout, in that case we should always print the file content,
     // changed or not. If we are printing diff/overwriting/listing files there will be nothing to do,
     // so we can just skip this.
     if (source == reformatted && (this->m_options & SkipIdenticalFilesMask) != 0)
-        return 0;
+    {
+        if (!m_stampFingerprint.isEmpty() && (this->m_options & StampedFilesMask) != 0 && !m_gitStaged)
+            Stamp::Write(path, m_stampFingerprint, stampTimes);
+
+        return result;
+    }
 
     if (this->m_options.testFlag(Option::ListFileName))
     {
@@ -86,45 +228,296 @@ int QmlFmt::InternalRun(QIODevice& input, const QString& path)
     else if (this->m_options.testFlag(Option::PrintDiff))
     {
         // Create and print diff
-        diff_match_patch differ;
-        const QList<Patch> patches = differ.patch_make(source, reformatted);
+        diff_match_patch differ = Differ();
+        QList<TextEdit> edits;
+        QList<Patch> patches;
+        if (m_diffAlgorithm == DiffAlgorithm::Tokens && EditScript::FromTokens(source, reformatted, dialect.isQmlLikeLanguage(), edits))
+            patches = differ.patch_make(source, EditScript::ToDiffs(source, edits));
+        else
+            patches = differ.patch_make(source, reformatted);
         qstdout << differ.patch_toText(patches);
     }
+    else if (this->m_options.testFlag(Option::PrintEdits))
+    {
+        // Print the edits turning the source into the reformatted file, preferably from the token alignment
+        QList<TextEdit> edits;
+        if (m_diffAlgorithm != DiffAlgorithm::Tokens || !EditScript::FromTokens(source, reformatted, dialect.isQmlLikeLanguage(), edits))
+            edits = EditScript::FromDiffs(Differ().diff_main(source, reformatted));
+
+        QJsonObject json;
+        json["file"] = path;
+        json["edits"] = EditScript::ToJson(source, edits);
+        qstdout << QJsonDocument(json).toJson(QJsonDocument::Compact) << "\n";
+    }
+    else if (this->m_options.testFlag(Option::OverwriteFile) && m_gitStaged)
+    {
+        // Staged files are written back to the index, not to disk
+        result.staged = reformatted.toUtf8();
+    }
+    else if (this->m_options.testFlag(Option::OverwriteFile))
+    {
+        // Overwrite original file, encoding a block at a time rather than copying all of it
+        QFile outFile(path);
+        outFile.open(QFile::WriteOnly | QFile::Text | QFile::Truncate);
+        Utf8Sink(outFile).Write(reformatted);
+        outFile.close();
+        if (!m_stampFingerprint.isEmpty())
+            Stamp::Write(path, m_stampFingerprint, Stamp::Times(path));
+    }
     else
     {
-        // Print reformatted file to stdout/original file
-        QFile outFile;
-        if (this->m_options.testFlag(Option::OverwriteFile))
+        // Print reformatted file to stdout once the files before it have been printed
+        result.formatted = reformatted.toUtf8();
+    }
+
+    return result;
+}
+
+QmlFmt::Formatted QmlFmt::Format(const QByteArray& content, const QString& source, const QString& path,
+    const QmlJS::Dialect& dialect, const QElapsedTimer& timer) const
+{
+    Formatted formatted;
+    const Utils::FilePath filePath = Utils::FilePath::fromString(path);
+
+    // Keep a copy of slow files for triage, whichever way formatting them ends
+    qint64 parseTime = 0;
+    qint64 reformatTime = 0;
+    const auto capture = qScopeGuard([&]() {
+        if (m_captureSlow > 0 && qMax(parseTime, reformatTime) > qint64(m_captureSlow) * 1000000)
         {
-            outFile.setFileName(path);
-            outFile.open(QFile::WriteOnly | QFile::Text | QFile::Truncate);
+            QBuffer buffer;
+            buffer.setData(content);
+            buffer.open(QBuffer::ReadOnly);
+            CaptureSlow(buffer, path, parseTime, reformatTime, 1, formatted.timedOut ? "timedOut" : "done");
         }
-        else
+    });
+
+    QmlJS::Document::MutablePtr document = QmlJS::Document::create(filePath, dialect);
+    document->setSource(source);
+    const qint64 parseStart = timer.nsecsElapsed();
+    document->parse();
+    parseTime = timer.nsecsElapsed() - parseStart;
+    if (TimedOut(timer, formatted))
+        return formatted;
+
+    if (!document->diagnosticMessages().isEmpty())
+    {
+        if (this->m_options.testFlag(Option::PrintError) || this->m_options.testFlag(Option::SyntaxCheck))
         {
-            outFile.open(stdout, QFile::WriteOnly | QFile::Text);
+            QTextStream qstderr(&formatted.errors);
+            for (const QmlJS::DiagnosticMessage& msg : document->diagnosticMessages())
+            {
+                qstderr << (msg.isError() ? "Error:" : "Warning:");
+
+                qstderr << msg.loc.startLine << ':' << msg.loc.startColumn << ':';
+
+                qstderr << ' ' << msg.message << "\n";
+            }
         }
+        formatted.returnValue = 1;
+        return formatted;
+    }
+
+    // Checking syntax only needs the parse
+    if (this->m_options.testFlag(Option::SyntaxCheck))
+        return formatted;
+
+    const qint64 reformatStart = timer.nsecsElapsed();
+    formatted.reformatted = QmlJS::reformat(document, m_indentSize, m_tabSize, m_lineLength);
+    reformatTime = timer.nsecsElapsed() - reformatStart;
+
+    // A file over its time budget is given up on even when the reformat did finish
+    TimedOut(timer, formatted);
+    return formatted;
+}
+
+bool QmlFmt::TimedOut(const QElapsedTimer& timer, Formatted& formatted) const
+{
+    // QmlJS cannot be interrupted while parsing or reformatting, so the time is checked between the steps
+    if (m_fileTimeout <= 0 || timer.elapsed() <= m_fileTimeout)
+        return false;
+
+    formatted.timedOut = true;
+    formatted.returnValue = 1;
+    return true;
+}
+
+void QmlFmt::CaptureSlow(QIODevice& content, const QString& path, qint64 parseTime, qint64 reformatTime, int chunks,
+    const QString& outcome) const
+{
+    // Copies are named by their content, so the same slow file is only kept once
+    QDir dir(m_captureDir);
+    if (!dir.mkpath("."))
+        return;
+
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(&content);
+    const QString name = hash.result().toHex() + "." + QFileInfo(path).suffix();
+    QFile copy(dir.filePath(name));
+    if (!copy.open(QFile::WriteOnly | QFile::Truncate) || !content.seek(0))
+        return;
+
+    // Big files formatted in chunks are copied a block at a time
+    for (QByteArray block = content.read(CopyBlockSize); !block.isEmpty(); block = content.read(CopyBlockSize))
+        copy.write(block);
+
+    QJsonObject options;
+    options["indent"] = m_indentSize;
+    options["tabSize"] = m_tabSize;
+    options["lineLength"] = m_lineLength;
+    options["arguments"] = QJsonArray::fromStringList(QCoreApplication::arguments().mid(1));
+
+    QJsonObject sidecar;
+    sidecar["file"] = path;
+    sidecar["size"] = content.size();
+    sidecar["parseMs"] = parseTime / 1000000.0;
+    sidecar["reformatMs"] = reformatTime / 1000000.0;
+    sidecar["chunks"] = chunks;
+    sidecar["outcome"] = outcome;
+    sidecar["version"] = QCoreApplication::applicationVersion();
+    sidecar["options"] = options;
 
-        const QByteArray bytes = reformatted.toUtf8();
-        outFile.write(bytes);
+    QFile sidecarFile(dir.filePath(name + ".json"));
+    if (sidecarFile.open(QFile::WriteOnly | QFile::Truncate))
+        sidecarFile.write(QJsonDocument(sidecar).toJson());
+}
+
+void QmlFmt::Print(const Result& result)
+{
+    QTextStream(stdout) << result.output;
+    QTextStream(stderr) << result.errors;
+
+    if (!result.formatted.isEmpty())
+    {
+        QFile outFile;
+        outFile.open(stdout, QFile::WriteOnly | QFile::Text);
+        outFile.write(result.formatted);
     }
 
-    return 0;
+    if (!result.formattedFile.isEmpty())
+    {
+        QFile formattedFile(result.formattedFile);
+        QFile outFile;
+        if (formattedFile.open(QFile::ReadOnly) && outFile.open(stdout, QFile::WriteOnly | QFile::Text))
+        {
+            for (QByteArray block = formattedFile.read(CopyBlockSize); !block.isEmpty(); block = formattedFile.read(CopyBlockSize))
+                outFile.write(block);
+        }
+
+        formattedFile.remove();
+    }
 }
 
-QmlFmt::QmlFmt(Options options, int indentSize, int tabSize, int lineLength)
+diff_match_patch QmlFmt::Differ() const
+{
+    diff_match_patch differ;
+    differ.Diff_Budget = m_diffBudget;
+    differ.Diff_Algorithm = ToDiffMatchPatch(m_diffAlgorithm);
+    differ.Diff_ParallelLines = ParallelDiffLines;
+    return differ;
+}
+
+QmlFmt::QmlFmt(Options options, int indentSize, int tabSize, int lineLength, int diffBudget, DiffAlgorithm diffAlgorithm)
     : m_options(options)
     , m_indentSize(indentSize)
     , m_tabSize(tabSize)
     , m_lineLength(lineLength)
+    , m_diffBudget(diffBudget)
+    , m_diffAlgorithm(diffAlgorithm)
+    , m_maxMemory(ResourceLimits::Memory() * 3 / 4)
+    , m_reportMemory(false)
+    , m_workers(0)
+    , m_shardIndex(0)
+    , m_shardCount(1)
+    , m_fileTimeout(0)
+    , m_captureSlow(0)
+    , m_gitStaged(false)
+    , m_streamThreshold(0)
+    , m_chunkCache(MaxChunkCache)
 {
     new QmlJS::ModelManagerInterface();
+    SetJobs(0);
+}
+
+void QmlFmt::SetJobs(int jobs)
+{
+    m_jobs = jobs;
+    if (m_jobs <= 0)
+    {
+        // One per core, but no more than the container lets us keep busy
+        const int cores = ResourceLimits::Cores();
+        m_jobs = cores > 0 ? qMin(cores, QThread::idealThreadCount()) : QThread::idealThreadCount();
+    }
+
+    // Diffs of huge files are split over the global pool, which gets the same limit
+    QThreadPool::globalInstance()->setMaxThreadCount(m_jobs);
+}
+
+void QmlFmt::SetMaxMemory(qint64 bytes)
+{
+    m_maxMemory = bytes;
+    m_reportMemory = true;
+}
+
+void QmlFmt::SetCostHistory(const QString& fileName)
+{
+    m_costHistory = fileName;
+}
+
+void QmlFmt::SetWorkers(int workers, const QStringList& arguments)
+{
+    m_workers = workers < 0 ? m_jobs : workers;
+    m_workerArguments = arguments;
+}
+
+void QmlFmt::SetShard(int index, int count)
+{
+    m_shardIndex = index;
+    m_shardCount = count;
+}
+
+void QmlFmt::SetFileTimeout(int milliseconds)
+{
+    m_fileTimeout = milliseconds;
+}
+
+void QmlFmt::SetStamps(bool stamps)
+{
+    // Stamps from other versions or with other options do not count
+    m_stampFingerprint.clear();
+    if (stamps)
+    {
+        const QString options = QString("%1 %2 %3 %4").arg(QCoreApplication::applicationVersion())
+            .arg(m_indentSize).arg(m_tabSize).arg(m_lineLength);
+        m_stampFingerprint = QCryptographicHash::hash(options.toUtf8(), QCryptographicHash::Sha1).toHex().left(16);
+    }
+}
+
+void QmlFmt::SetChangedSince(const QString& ref)
+{
+    m_changedSince = ref;
+}
+
+void QmlFmt::SetStreamThreshold(qint64 bytes)
+{
+    m_streamThreshold = bytes;
+}
+
+void QmlFmt::SetCaptureSlow(int milliseconds, const QString& dir)
+{
+    m_captureSlow = milliseconds;
+    m_captureDir = dir;
 }
 
 int QmlFmt::Run()
 {
     QFile file;
     file.open(stdin, QFile::ReadOnly | QFile::Text);
-    return this->InternalRun(file, "stdin.qml");
+    QElapsedTimer timer;
+    timer.start();
+    const Result result = this->InternalRun(file, "stdin.qml", timer, -1, QList<qint64>());
+    Print(result);
+    return result.returnValue;
 }
 
 int QmlFmt::Run(QStringList paths)
@@ -134,15 +527,170 @@ int QmlFmt::Run(QStringList paths)
         return Run();
     }
 
-    int returnValue = 0;
+    if (!m_changedSince.isEmpty())
+        return RunChanged(paths);
+
+    return RunFiles(FindFiles(paths));
+}
+
+int QmlFmt::RunChanged(const QStringList& paths)
+{
+    QStringList changedFiles;
+    QString error;
+    if (!Git::ChangedFiles(m_changedSince, paths, changedFiles, error))
+    {
+        QTextStream(stderr) << error;
+        return 1;
+    }
+
+    // Files are still found as usual, so they follow the same rules, but only the changed ones are formatted
+    const QSet<QString> changed(changedFiles.cbegin(), changedFiles.cend());
+    QList<File> files;
+    for (const File& file : FindFiles(paths))
+    {
+        if (!file.valid || changed.contains(QFileInfo(file.path).canonicalFilePath()))
+            files.append(file);
+    }
+
+    MarkSameSize(files);
+    return RunFiles(files);
+}
+
+int QmlFmt::RunStaged(const QStringList& paths)
+{
+    QList<Git::StagedFile> stagedFiles;
+    QString error;
+    if (!Git::StagedFiles(paths, stagedFiles, error))
+    {
+        QTextStream(stderr) << error;
+        return 1;
+    }
+
+    QList<File> files;
+    for (const Git::StagedFile& stagedFile : std::as_const(stagedFiles))
+    {
+        File file{ stagedFile.fileName, stagedFile.content.size(), true };
+        file.indexPath = stagedFile.path;
+        file.content = stagedFile.content;
+        files.append(file);
+    }
+
+    MarkSameSize(files);
+    m_gitStaged = true;
+    return RunFiles(files);
+}
+
+int QmlFmt::Watch(const QString& dir)
+{
+    // Format the whole tree once, then only the files that change, in this process so QmlJS stays warm
+    RunFiles(FindFiles({ dir }));
+
+    QFileSystemWatcher watcher;
+    QSet<QString> watchedDirs;
+    QSet<QString> pending;
+    QHash<QString, QPair<QDateTime, qint64>> handled;
+    QTimer debounce;
+    debounce.setSingleShot(true);
+    debounce.setInterval(WatchDebounce);
+
+    // How files looked when qmlfmt was done with them, so writing them itself is not taken for a change
+    const auto remember = [&handled](const QString& path) {
+        const QFileInfo info(path);
+        handled[path] = qMakePair(info.lastModified(), info.size());
+    };
+
+    // Watches dir and the QML files and directories in it the same way they are found when formatting a tree,
+    // files not seen before are formatted if changed is set.
+    std::function<void(const QString&, bool)> scan = [&](const QString& dir, bool changed) {
+        if (!watchedDirs.contains(dir))
+        {
+            watchedDirs.insert(dir);
+            watcher.addPath(dir);
+        }
+
+        QDirIterator entries(dir, QStringList{ "*.qml" }, QDir::Files | QDir::AllDirs | QDir::NoDotAndDotDot);
+        while (entries.hasNext())
+        {
+            const QString path = entries.next();
+            if (entries.fileInfo().isDir())
+            {
+                if (!entries.fileInfo().isSymLink() && !watchedDirs.contains(path))
+                    scan(path, changed);
+            }
+            else if (!handled.contains(path) && !pending.contains(path))
+            {
+                watcher.addPath(path);
+                if (changed)
+                    pending.insert(path);
+                else
+                    remember(path);
+            }
+        }
+    };
+
+    QObject::connect(&watcher, &QFileSystemWatcher::fileChanged, [&](const QString& path) {
+        pending.insert(path);
+        debounce.start();
+    });
+
+    QObject::connect(&watcher, &QFileSystemWatcher::directoryChanged, [&](const QString& path) {
+        if (QFileInfo(path).isDir())
+            scan(path, true);
+        else
+            watchedDirs.remove(path);
+
+        debounce.start();
+    });
+
+    QObject::connect(&debounce, &QTimer::timeout, [&]() {
+        QList<File> files;
+        for (const QString& path : std::as_const(pending))
+        {
+            const QFileInfo info(path);
+            if (!info.isFile())
+            {
+                handled.remove(path);
+                continue;
+            }
+
+            if (handled.value(path) == qMakePair(info.lastModified(), info.size()))
+                continue;
+
+            // Editors saving by replacing the file drop it from the watch
+            watcher.addPath(path);
+            files.append({ path, info.size(), true });
+        }
+
+        pending.clear();
+        if (files.isEmpty())
+            return;
+
+        std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.path < b.path; });
+
+        // Contents formatted in earlier rounds are not coming back
+        m_formatted.clear();
+        RunFiles(files);
+        for (const File& file : std::as_const(files))
+            remember(file.path);
+    });
+
+    scan(dir, false);
+    return QCoreApplication::exec();
+}
+
+QList<QmlFmt::File> QmlFmt::FindFiles(const QStringList& paths) const
+{
+    // Collect all files up front, along with their size as an estimate of how long they take to format.
+    // Files in other shards are skipped before anything but their name is looked at.
+    const QDir root = m_shardCount > 1 ? RepositoryRoot() : QDir::current();
+    QList<File> files;
     for (const QString& fileOrDir : paths)
     {
         QFileInfo fileInfo(fileOrDir);
         if (fileInfo.isFile())
         {
-            QFile file(fileOrDir);
-            file.open(QFile::ReadOnly | QFile::Text);
-            returnValue |= this->InternalRun(file, fileOrDir);
+            if (InShard(root, fileOrDir))
+                files.append({ fileOrDir, fileInfo.size(), true });
         }
         else if (fileInfo.isDir())
         {
@@ -154,17 +702,594 @@ int QmlFmt::Run(QStringList paths)
 
             while (iter.hasNext())
             {
-                QFile file(iter.next());
-                file.open(QFile::ReadOnly | QFile::Text);
-                returnValue |= this->InternalRun(file, file.fileName());
+                const QString path = iter.next();
+                if (InShard(root, path))
+                    files.append({ path, iter.fileInfo().size(), true });
             }
         }
-        else
+        else if (InShard(root, fileOrDir))
+        {
+            files.append({ fileOrDir, 0, false });
+        }
+    }
+
+    MarkSameSize(files);
+    return files;
+}
+
+void QmlFmt::MarkSameSize(QList<File>& files)
+{
+    // Only files of the same size can have the same content, the others are not worth hashing and keeping
+    QHash<qint64, int> sizes;
+    for (const File& file : files)
+        sizes[file.size]++;
+
+    for (File& file : files)
+        file.sameSize = file.valid && sizes[file.size] > 1;
+}
+
+bool QmlFmt::InShard(const QDir& root, const QString& path) const
+{
+    if (m_shardCount <= 1)
+        return true;
+
+    // The same file gets the same path on every machine, however it was named on the command line
+    const QString relativePath = QDir::cleanPath(root.relativeFilePath(QFileInfo(path).absoluteFilePath()));
+    return StableHash(relativePath.toUtf8()) % m_shardCount == quint64(m_shardIndex);
+}
+
+int QmlFmt::RunFiles(const QList<File>& files)
+{
+    // Count the files that may share their formatting, so it is kept no longer than they need it
+    {
+        QMutexLocker locker(&m_formattedMutex);
+        m_sameSizeRemaining.clear();
+        for (const File& file : files)
+        {
+            if (file.sameSize)
+                m_sameSizeRemaining[file.size]++;
+        }
+    }
+
+    CostHistory history;
+    if (!m_costHistory.isEmpty())
+        history.Load(m_costHistory);
+
+    QList<qint64> costs;
+    for (const File& file : files)
+        costs.append(history.Estimate(file.path, file.size));
+
+    // Start the most expensive files first, so no core is still busy with a big file picked up last
+    // while the others are idle.
+    QList<int> order(files.count());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&costs](int a, int b) { return costs[a] > costs[b]; });
+
+    // Batch up the small files at the end, but leave every thread several batches to balance the load with.
+    // Workers are fed one file at a time.
+    const qint64 totalCost = std::accumulate(costs.cbegin(), costs.cend(), qint64(0));
+    const qint64 batchCost = std::min(MaxBatchCost, totalCost / (m_jobs * 4));
+    QList<QList<int>> batches;
+    QList<QPair<int, int>> locations(files.count());
+    qint64 cost = 0;
+    for (int index : order)
+    {
+        if (batches.isEmpty() || m_workers > 0 || cost + costs[index] > batchCost)
+        {
+            batches.append(QList<int>());
+            cost = 0;
+        }
+
+        locations[index] = qMakePair(batches.count() - 1, batches.last().count());
+        batches.last().append(index);
+        cost += costs[index];
+    }
+
+    // A batch holds the memory of its biggest file while it runs, and its results until they are printed.
+    QList<qint64> footprints;
+    for (const QList<int>& batch : batches)
+    {
+        qint64 footprint = 0;
+        for (int index : batch)
+            footprint = qMax(footprint, this->Footprint(files[index]));
+        footprints.append(footprint);
+    }
+
+    const auto buffered = [](const Result& result) {
+        return (result.output.size() + result.errors.size()) * qint64(sizeof(QChar)) + result.formatted.size() + result.staged.size();
+    };
+
+    // Threads take the most expensive batch that fits in the memory budget, so big files wait while smaller ones
+    // keep the other threads busy. The batch holding the next file to print is taken whether it fits or not, as
+    // printing is what frees the memory of the results.
+    MemoryBudget memory(m_maxMemory);
+    QMutex scheduleMutex;
+    QWaitCondition scheduleChanged;
+    QList<bool> taken(batches.count(), false);
+    QList<bool> done(batches.count(), false);
+    QList<QList<Result>> results(batches.count());
+    int firstUntaken = 0;
+    int printed = 0;
+    int active = 0;
+    int reserving = 0;
+
+    // Files are formatted on the global pool, whose threads also format the chunks of big files and the parts of
+    // big diffs, so all of them share the same jobs. Workers are fed by threads of their own.
+    QThreadPool workerPool;
+    QThreadPool* pool = QThreadPool::globalInstance();
+    const int threads = m_workers > 0 ? m_workers : m_jobs;
+    if (m_workers > 0)
+    {
+        workerPool.setMaxThreadCount(m_workers);
+        pool = &workerPool;
+    }
+
+    const auto acquire = [&](int batch, qint64 bytes) {
+        if (printed < files.count() && locations[printed].first == batch)
+        {
+            memory.Acquire(bytes);
+            return true;
+        }
+
+        return memory.TryAcquire(bytes);
+    };
+
+    const auto take = [&]() {
+        QMutexLocker locker(&scheduleMutex);
+        for (;;)
         {
-            QTextStream(stderr) << "Path is not valid file or directory: " << fileOrDir << "\n";
-            returnValue |= 1;
+            while (firstUntaken < batches.count() && taken[firstUntaken])
+                firstUntaken++;
+
+            if (firstUntaken == batches.count())
+                return -1;
+
+            for (int batch = firstUntaken; batch < batches.count(); batch++)
+            {
+                if (taken[batch] || !acquire(batch, footprints[batch]))
+                    continue;
+
+                taken[batch] = true;
+                active++;
+                return batch;
+            }
+
+            // Nothing fits, the chunks of the files running can have this thread meanwhile
+            pool->releaseThread();
+            scheduleChanged.wait(&scheduleMutex);
+            pool->reserveThread();
+        }
+    };
+
+    // A file that cannot be formatted in chunks after all is formatted as a whole, its batch first waits for the
+    // rest of the memory that needs under the same rules. Once every batch running waits for memory none of them
+    // would free any, the last to wait takes it regardless.
+    const auto reserve = [&](int batch, qint64 bytes) {
+        QMutexLocker locker(&scheduleMutex);
+        while (!acquire(batch, bytes))
+        {
+            if (reserving + 1 == active)
+            {
+                memory.Acquire(bytes);
+                break;
+            }
+
+            reserving++;
+            pool->releaseThread();
+            scheduleChanged.wait(&scheduleMutex);
+            pool->reserveThread();
+            reserving--;
         }
+
+        footprints[batch] += bytes;
+    };
+
+    QList<QFuture<void>> running;
+    for (int thread = 0; thread < threads; thread++)
+    {
+        running.append(QtConcurrent::run(pool, [&]() {
+            // With workers, every thread feeds its own worker process
+            QProcess process;
+            for (int batch = take(); batch >= 0; batch = take())
+            {
+                QList<Result> batchResults;
+                for (int index : batches[batch])
+                {
+                    const bool onDisk = files[index].valid && files[index].indexPath.isEmpty();
+                    if (m_workers > 0 && onDisk)
+                        batchResults.append(this->RunFileInWorker(process, files[index]));
+                    else
+                        batchResults.append(this->RunFile(files[index], [&](qint64 bytes) { reserve(batch, bytes); }));
+                }
+
+                QMutexLocker locker(&scheduleMutex);
+                memory.Release(footprints[batch]);
+                for (const Result& result : std::as_const(batchResults))
+                    memory.Acquire(buffered(result));
+
+                results[batch] = std::move(batchResults);
+                done[batch] = true;
+                active--;
+                scheduleChanged.wakeAll();
+            }
+
+            process.closeWriteChannel();
+            process.waitForFinished();
+        }));
+    }
+
+    // Results are printed in the order the files were found, whatever order they finish in,
+    // so the output is the same as when formatting the files one by one.
+    int returnValue = 0;
+    QList<Git::StagedFile> restaged;
+    for (int index = 0; index < files.count(); index++)
+    {
+        QMutexLocker locker(&scheduleMutex);
+        const int batch = locations[index].first;
+        while (!done[batch])
+            scheduleChanged.wait(&scheduleMutex);
+
+        const Result result = std::exchange(results[batch][locations[index].second], Result());
+        locker.unlock();
+
+        Print(result);
+        returnValue |= result.returnValue;
+
+        locker.relock();
+        memory.Release(buffered(result));
+        printed = index + 1;
+        scheduleChanged.wakeAll();
+        locker.unlock();
+
+        if (!result.staged.isEmpty())
+            restaged.append({ files[index].indexPath, files[index].path, result.staged });
+
+        if (result.measured)
+            history.Record(files[index].path, result.hash, result.size, result.cost);
+    }
+
+    for (QFuture<void>& future : running)
+        future.waitForFinished();
+
+    QString error;
+    if (!restaged.isEmpty() && !Git::Stage(restaged, error))
+    {
+        QTextStream(stderr) << error;
+        returnValue = 1;
+    }
+
+    if (!m_costHistory.isEmpty() && !history.Save(m_costHistory))
+    {
+        QTextStream(stderr) << "Could not save cost history to " << m_costHistory << "\n";
+    }
+
+    if (m_reportMemory)
+    {
+        QTextStream(stderr) << "Peak estimated memory use: " << memory.Peak() / (1024 * 1024) << " MiB of "
+            << (m_maxMemory > 0 ? QString::number(m_maxMemory / (1024 * 1024)) + " MiB" : QString("unlimited")) << "\n";
+        if (ResourceLimits::PeakResident() > 0)
+            QTextStream(stderr) << "Peak resident memory: " << ResourceLimits::PeakResident() / (1024 * 1024) << " MiB\n";
     }
 
     return returnValue;
 }
+
+QmlFmt::Result QmlFmt::RunFile(const File& file, const std::function<void(qint64)>& reserve) const
+{
+    if (!file.valid)
+    {
+        Result result;
+        QTextStream(&result.errors) << "Path is not valid file or directory: " << file.path << "\n";
+        result.returnValue = 1;
+        return result;
+    }
+
+    // The formatting shared with files of the same size is dropped once the last of them is done
+    const auto sameSizeDone = qScopeGuard([this, &file]() {
+        if (!file.sameSize)
+            return;
+
+        QMutexLocker locker(&m_formattedMutex);
+        if (--m_sameSizeRemaining[file.size] == 0)
+        {
+            m_sameSizeRemaining.remove(file.size);
+            m_formatted.remove(file.size);
+        }
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Staged files are formatted as they are in the index
+    if (!file.indexPath.isEmpty())
+    {
+        QBuffer input;
+        input.setData(file.content);
+        input.open(QBuffer::ReadOnly);
+        Result result = this->InternalRun(input, file.path, timer, file.sameSize ? file.size : -1, QList<qint64>());
+        result.cost = timer.nsecsElapsed();
+        return result;
+    }
+
+    // A file stamped as formatted with the same options is skipped without opening it
+    if (!m_stampFingerprint.isEmpty() && (this->m_options & StampedFilesMask) != 0 && Stamp::IsCurrent(file.path, m_stampFingerprint))
+    {
+        Result result;
+        result.size = file.size;
+        result.cost = timer.nsecsElapsed();
+        return result;
+    }
+
+    // Stamps only vouch for the file as it was before it was read
+    const QList<qint64> stampTimes = m_stampFingerprint.isEmpty() ? QList<qint64>() : Stamp::Times(file.path);
+
+    // Big files are formatted in chunks if they can be, as a whole otherwise. Only their chunks were reserved
+    // memory for, so the rest of what the whole file needs is reserved before reading it.
+    Result result;
+    if (Streams(file))
+    {
+        if (RunChunked(file, timer, stampTimes, result))
+        {
+            result.cost = timer.nsecsElapsed();
+            return result;
+        }
+
+        if (reserve)
+            reserve(file.size * FootprintPerByte - Footprint(file));
+    }
+
+    QFile input(file.path);
+    input.open(QFile::ReadOnly | QFile::Text);
+    result = this->InternalRun(input, file.path, timer, file.sameSize ? file.size : -1, stampTimes);
+    result.cost = timer.nsecsElapsed();
+    return result;
+}
+
+bool QmlFmt::Streams(const File& file) const
+{
+    if (!file.valid || !file.indexPath.isEmpty() || QFileInfo(file.path).suffix() != "qml")
+        return false;
+
+    // Listing only needs to know whether the output differs, which its first changed chunk tells
+    if (this->m_options.testFlag(Option::ListFileName))
+        return m_streamThreshold > 0 && file.size >= ListChunkThreshold;
+
+    // Printing and overwriting need nothing but the output, the other modes compare it with the whole source
+    return m_streamThreshold > 0 && file.size >= m_streamThreshold &&
+        (this->m_options & (Option::PrintDiff | Option::PrintEdits | Option::SyntaxCheck)) == 0;
+}
+
+bool QmlFmt::RunChunked(const File& file, const QElapsedTimer& timer, const QList<qint64>& stampTimes, Result& result) const
+{
+    QFile input(file.path);
+    if (!input.open(QFile::ReadOnly | QFile::Text))
+        return false;
+
+    ChunkedFormatter formatter(file.path, m_indentSize, m_tabSize, m_lineLength, ChunkSize(file), &m_chunkCache);
+    formatter.SetJobs(ChunkJobs());
+
+    // Keep a copy of slow files for triage as Format does. Chunks are parsed and reformatted in turn, all of the
+    // time is counted as reformatting.
+    bool expired = false;
+    const auto capture = qScopeGuard([&]() {
+        QFile content(file.path);
+        if (m_captureSlow > 0 && timer.elapsed() > m_captureSlow && content.open(QFile::ReadOnly))
+            CaptureSlow(content, file.path, 0, timer.nsecsElapsed(), formatter.Chunks(), expired ? "timedOut" : "done");
+    });
+
+    // A file past the file timeout is given up on as in Format, checked before every chunk is written
+    const auto timedOut = [&]() {
+        expired = true;
+        QTextStream(&result.errors) << "Timed out formatting " << file.path << " after " << timer.elapsed() << " ms\n";
+        result.returnValue = 1;
+        return true;
+    };
+
+    result.size = input.size();
+    if (!m_costHistory.isEmpty())
+    {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(&input);
+        result.hash = hash.result();
+        input.seek(0);
+    }
+
+    if (this->m_options.testFlag(Option::ListFileName))
+    {
+        // Formatting stops at the first chunk that differs from the source. Errors in the chunks after it go
+        // unreported, the file is listed either way.
+        QFile source(file.path);
+        if (!source.open(QFile::ReadOnly | QFile::Text))
+            return false;
+
+        CompareSink comparer(source);
+        DeadlineSink deadline(comparer, timer, m_fileTimeout);
+        const bool formatted = formatter.Format(input, deadline);
+        if (deadline.Expired())
+            return timedOut();
+
+        if (!formatted && !comparer.Differs())
+            return false;
+
+        // A listing that stopped early did not format the whole file, its time says little about the file
+        result.measured = comparer.Matches();
+        if (!comparer.Matches())
+            QTextStream(&result.output) << file.path << "\n";
+        else if (!m_stampFingerprint.isEmpty())
+            Stamp::Write(file.path, m_stampFingerprint, stampTimes);
+
+        return true;
+    }
+
+    if (this->m_options.testFlag(Option::OverwriteFile))
+    {
+        // The original is only replaced once the whole file is formatted, and only if that changed it
+        QFile source(file.path);
+        QSaveFile output(file.path);
+        if (!source.open(QFile::ReadOnly | QFile::Text) || !output.open(QFile::WriteOnly | QFile::Text))
+            return false;
+
+        Utf8Sink writer(output);
+        CompareSink comparer(source, &writer);
+        DeadlineSink deadline(comparer, timer, m_fileTimeout);
+        if (!formatter.Format(input, deadline))
+        {
+            output.cancelWriting();
+            return deadline.Expired() ? timedOut() : false;
+        }
+
+        result.measured = true;
+        if (comparer.Matches())
+            output.cancelWriting();
+        else if (!output.commit())
+        {
+            QTextStream(&result.errors) << "Could not write " << file.path << ": " << output.errorString() << "\n";
+            result.returnValue = 1;
+            return true;
+        }
+
+        if (!m_stampFingerprint.isEmpty())
+            Stamp::Write(file.path, m_stampFingerprint, comparer.Matches() ? stampTimes : Stamp::Times(file.path));
+
+        return true;
+    }
+
+    // Printed files wait on disk until the files before them have been printed
+    QTemporaryFile output(QDir::temp().filePath("qmlfmt-XXXXXX.qml"));
+    output.setAutoRemove(false);
+    if (!output.open())
+        return false;
+
+    Utf8Sink writer(output);
+    DeadlineSink deadline(writer, timer, m_fileTimeout);
+    if (!formatter.Format(input, deadline))
+    {
+        output.remove();
+        return deadline.Expired() ? timedOut() : false;
+    }
+
+    result.formattedFile = output.fileName();
+    result.measured = true;
+    return true;
+}
+
+int QmlFmt::ChunkJobs() const
+{
+    // Listing formats a chunk at a time, so it stops at the first that differs without formatting the others
+    return this->m_options.testFlag(Option::ListFileName) ? 1 : m_jobs;
+}
+
+qint64 QmlFmt::ChunkSize(const File& file) const
+{
+    const qint64 chunkSize = m_streamThreshold > 0 ? qMin(MaxStreamChunk, m_streamThreshold / 8) : MaxStreamChunk;
+    if (this->m_options.testFlag(Option::ListFileName))
+        return qMin(chunkSize, file.size / ListChunks);
+
+    return qMin(chunkSize, qMax(MinParallelChunk, file.size / (m_jobs * 4)));
+}
+
+qint64 QmlFmt::Footprint(const File& file) const
+{
+    // Files formatted in chunks hold the chunks being formatted and the one being read, and reserve the rest when
+    // they have to be formatted as a whole after all. Workers cannot ask for more while formatting, they are
+    // given all a file may need.
+    if (Streams(file) && m_workers == 0)
+        return qMin(file.size, (ChunkJobs() + 1) * ChunkSize(file)) * FootprintPerByte;
+
+    return file.size * FootprintPerByte;
+}
+
+QmlFmt::Result QmlFmt::RunFileInWorker(QProcess& worker, const File& file) const
+{
+    Result result;
+    if (worker.state() == QProcess::NotRunning)
+    {
+        // Start a new worker, first time round or after the previous one crashed or timed out. Its error output
+        // goes straight to ours, so the reason it crashed is not lost.
+        worker.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        worker.start(QCoreApplication::applicationFilePath(), m_workerArguments);
+        if (!worker.waitForStarted())
+        {
+            QTextStream(&result.errors) << "Could not start worker to format " << file.path << ": " << worker.errorString() << "\n";
+            result.returnValue = 1;
+            return result;
+        }
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Paths go one per line, results come back as their length followed by the serialized result.
+    // A worker past the file timeout is killed, which frees it for the next file right away. Without a
+    // timeout a slow file is waited for however long it takes.
+    worker.write(QUrl::toPercentEncoding(file.path) + "\n");
+    quint32 length = 0;
+    while (worker.bytesAvailable() < qint64(sizeof(length)) || worker.bytesAvailable() < qint64(sizeof(length) + length))
+    {
+        const qint64 remaining = m_fileTimeout > 0 ? m_fileTimeout - timer.elapsed() : -1;
+        if ((m_fileTimeout > 0 && remaining <= 0) || !worker.waitForReadyRead(int(remaining)))
+        {
+            const bool crashed = worker.state() == QProcess::NotRunning;
+            if (!crashed)
+            {
+                worker.kill();
+                worker.waitForFinished();
+                QTextStream(&result.errors) << "Timed out formatting " << file.path << " after " << timer.elapsed() << " ms\n";
+            }
+            else
+            {
+                QTextStream(&result.errors) << "Worker crashed formatting " << file.path << "\n";
+            }
+
+            // The worker is gone before it could keep a copy itself, all of its time is counted as reformatting
+            QFile content(file.path);
+            if (m_captureSlow > 0 && content.open(QFile::ReadOnly))
+                CaptureSlow(content, file.path, 0, timer.nsecsElapsed(), 0, crashed ? "crashed" : "timedOut");
+
+            result.returnValue = 1;
+            return result;
+        }
+
+        if (worker.bytesAvailable() >= qint64(sizeof(length)))
+            QDataStream(worker.peek(sizeof(length))) >> length;
+    }
+
+    worker.read(sizeof(length));
+    QDataStream stream(worker.read(length));
+    stream >> result.returnValue >> result.output >> result.errors >> result.formatted >> result.formattedFile >> result.hash
+        >> result.size >> result.cost >> result.measured;
+    return result;
+}
+
+int QmlFmt::RunWorker()
+{
+    // Workers format a file at a time on one thread, the parent runs as many of them as it has jobs
+    SetJobs(1);
+
+    QFile input;
+    input.open(stdin, QFile::ReadOnly);
+    QFile output;
+    output.open(stdout, QFile::WriteOnly);
+
+    // Tests make a worker die in the middle of a file by naming it here
+    const QString crashOn = qEnvironmentVariable("QMLFMT_WORKER_CRASH_ON");
+
+    for (QByteArray line = input.readLine(); !line.isEmpty(); line = input.readLine())
+    {
+        const QString path = QString::fromUtf8(QByteArray::fromPercentEncoding(line.trimmed()));
+        if (!crashOn.isEmpty() && QFileInfo(path).fileName() == crashOn)
+            std::abort();
+        const Result result = RunFile({ path, QFileInfo(path).size(), true });
+
+        QByteArray serialized;
+        QDataStream(&serialized, QIODevice::WriteOnly)
+            << result.returnValue << result.output << result.errors << result.formatted << result.formattedFile << result.hash
+            << result.size << result.cost << result.measured;
+        QByteArray length;
+        QDataStream(&length, QIODevice::WriteOnly) << quint32(serialized.size());
+        output.write(length + serialized);
+        output.flush();
+    }
+
+    return 0;
+}
@@ -26,25 +26,185 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <functional>
+
+#include <QByteArray>
+#include <QFuture>
+#include <QHash>
+#include <QMutex>
 #include <QString>
 
+#include "chunkedformatter.h"
+
+class diff_match_patch;
+class QDir;
+class QElapsedTimer;
+class QProcess;
+namespace QmlJS { class Dialect; }
+
 class QmlFmt
 {
 public:
-    enum class Option { None = 0x0, ListFileName = 0x1, OverwriteFile = 0x2, PrintError = 0x4, PrintDiff = 0x8};
+    enum class Option { None = 0x0, ListFileName = 0x1, OverwriteFile = 0x2, PrintError = 0x4, PrintDiff = 0x8, PrintEdits = 0x10, SyntaxCheck = 0x20};
     Q_DECLARE_FLAGS(Options, Option)
+    enum class DiffAlgorithm { Tokens, Myers, Patience, Histogram };
 
-    QmlFmt(Options options, int indentSize, int tabSize, int lineLength);
+    QmlFmt(Options options, int indentSize, int tabSize, int lineLength, int diffBudget, DiffAlgorithm diffAlgorithm);
     
+    // How many files to format at once, 0 for one per core.
+    void SetJobs(int jobs);
+
+    // File to remember formatting costs in, used to schedule the slowest files first.
+    void SetCostHistory(const QString& fileName);
+
+    // Budget for the estimated memory use of the files formatted at once and of the results waiting to be printed,
+    // 0 for no limit. Reports the peak use at the end of the run. Defaults to three quarters of the memory the
+    // container allows, without report.
+    void SetMaxMemory(qint64 bytes);
+
+    // Format files in this many worker processes instead of threads, so a crash only costs the file it happened
+    // on, as does a hang past the file timeout. The arguments start a worker with the same formatting options.
+    // Negative for one worker per job, 0 to format in threads.
+    void SetWorkers(int workers, const QStringList& arguments);
+
+    // Only format the files that fall in this shard out of count, by a hash of their path in the repository.
+    // Running every shard formats every file exactly once.
+    void SetShard(int index, int count);
+
+    // Give up on files taking longer than this many milliseconds, 0 for no limit. They are reported as errors
+    // and left as they are. In worker processes a file is abandoned right away, in threads when the step it
+    // is in finishes. Files read from standard input or the git index are always formatted in threads.
+    void SetFileTimeout(int milliseconds);
+
+    // Copy files taking longer than this many milliseconds to parse or reformat into dir, 0 to copy none.
+    // Every copy gets a JSON sidecar with the options, timings, size and version used, and how formatting ended:
+    // done, timedOut or crashed, and how many chunks the file was formatted in, 1 for a whole file and 0 if a worker
+    // was lost before telling. Files a worker was stopped or crashed on are copied whatever their time.
+    void SetCaptureSlow(int milliseconds, const QString& dir);
+
+    // Stamp files found or written formatted by -l and -w in an extended attribute, and skip files whose stamp
+    // is still current without reading them.
+    void SetStamps(bool stamps);
+
+    // Only format the files changed since the merge base of ref and HEAD, according to git.
+    void SetChangedSince(const QString& ref);
+
+    // Format qml files of at least this many bytes chunk by chunk on all cores when printing or overwriting them,
+    // so their memory use does not grow with their size and big files do not wait on one core. -l checks files of 64 KiB or more chunk by chunk up to their first change, leaving syntax
+    // errors after it unreported. 0 formats and checks every file as a whole.
+    void SetStreamThreshold(qint64 bytes);
+
     int Run();
     int Run(QStringList paths);
 
+    // Formats the QML files staged in git instead of those on disk, limited to paths if any are given.
+    // Under -w the index is updated, the files on disk are left as they are.
+    int RunStaged(const QStringList& paths);
+
+    // Formats the QML files in dir, then keeps formatting the ones that change until qmlfmt is stopped.
+    int Watch(const QString& dir);
+
+    // Formats the files named on standard input one by one and sends their results to standard output,
+    // until standard input is closed.
+    int RunWorker();
+
 private:
+    // A file to format, size is only used for scheduling.
+    struct File
+    {
+        QString path;
+        qint64 size;
+        bool valid;
+
+        // Another file has the same size, so it may have the same content
+        bool sameSize = false;
+
+        // Set for files staged in git, content is formatted instead of the file on disk
+        QString indexPath;
+        QByteArray content;
+    };
+
+    // What formatting a source gave, the same for every file with that source.
+    struct Formatted
+    {
+        int returnValue = 0;
+        bool timedOut = false;
+        QString errors;
+        QString reformatted;
+    };
+
+    // What formatting a file printed, held until all files before it have been printed.
+    struct Result
+    {
+        int returnValue = 0;
+        QString output;
+        QString errors;
+        QByteArray formatted;
+
+        // Temporary file holding the reformatted content of a file formatted in chunks, removed once printed
+        QString formattedFile;
+
+        // Reformatted content of a staged file under -w, the index is updated once all files are done
+        QByteArray staged;
+
+        // Measurements for the cost history, only recorded when the file was formatted rather than skipped or copied from a twin
+        QByteArray hash;
+        qint64 size = 0;
+        qint64 cost = 0;
+        bool measured = false;
+    };
+
     Options m_options;
     int m_indentSize;
     int m_tabSize;
     int m_lineLength;
-    int InternalRun(QIODevice& input, const QString& path);
+    int m_diffBudget;
+    DiffAlgorithm m_diffAlgorithm;
+    int m_jobs;
+    QString m_costHistory;
+    qint64 m_maxMemory;
+    bool m_reportMemory;
+    int m_workers;
+    QStringList m_workerArguments;
+    int m_shardIndex;
+    int m_shardCount;
+    int m_fileTimeout;
+    int m_captureSlow;
+    QString m_captureDir;
+    QByteArray m_stampFingerprint;
+    bool m_gitStaged;
+    QString m_changedSince;
+    qint64 m_streamThreshold;
+
+    // Formatting of contents shared by several files, by file size, then by language and content hash. The
+    // entries of a size are dropped once the last file of that size is done.
+    mutable QMutex m_formattedMutex;
+    mutable QHash<qint64, QHash<QByteArray, QFuture<Formatted>>> m_formatted;
+    mutable QHash<qint64, int> m_sameSizeRemaining;
+
+    // Members repeated within and across files formatted in chunks are only formatted once
+    mutable ChunkCache m_chunkCache;
+    Result InternalRun(QIODevice& input, const QString& path, const QElapsedTimer& timer, qint64 deduplicateSize,
+        const QList<qint64>& stampTimes) const;
+    Formatted Format(const QByteArray& content, const QString& source, const QString& path,
+        const QmlJS::Dialect& dialect, const QElapsedTimer& timer) const;
+    bool TimedOut(const QElapsedTimer& timer, Formatted& formatted) const;
+    void CaptureSlow(QIODevice& content, const QString& path, qint64 parseTime, qint64 reformatTime, int chunks,
+        const QString& outcome) const;
+    QList<File> FindFiles(const QStringList& paths) const;
+    int RunChanged(const QStringList& paths);
+    bool InShard(const QDir& root, const QString& path) const;
+    static void MarkSameSize(QList<File>& files);
+    int RunFiles(const QList<File>& files);
+    Result RunFile(const File& file, const std::function<void(qint64)>& reserve = {}) const;
+    bool Streams(const File& file) const;
+    bool RunChunked(const File& file, const QElapsedTimer& timer, const QList<qint64>& stampTimes, Result& result) const;
+    int ChunkJobs() const;
+    qint64 ChunkSize(const File& file) const;
+    qint64 Footprint(const File& file) const;
+    Result RunFileInWorker(QProcess& worker, const File& file) const;
+    static void Print(const Result& result);
+    diff_match_patch Differ() const;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(QmlFmt::Options)
\ No newline at end of file
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QStringList>
+#include <limits>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+#include "resources.h"
+
+// Reads the first line of a cgroup control file, empty if there is none.
+static QByteArray ReadControlFile(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QFile::ReadOnly))
+        return QByteArray();
+
+    return file.readLine().trimmed();
+}
+
+qint64 ResourceLimits::Memory()
+{
+    // cgroup v2 first, "max" means unlimited
+    bool ok = false;
+    qint64 limit = ReadControlFile("/sys/fs/cgroup/memory.max").toLongLong(&ok);
+    if (ok && limit > 0)
+        return limit;
+
+    // cgroup v1 reports a huge number when unlimited
+    limit = ReadControlFile("/sys/fs/cgroup/memory/memory.limit_in_bytes").toLongLong(&ok);
+    if (ok && limit > 0 && limit < std::numeric_limits<qint64>::max() / 2)
+        return limit;
+
+    return 0;
+}
+
+int ResourceLimits::Cores()
+{
+    // cgroup v2 holds "<quota> <period>", with "max" as quota when unlimited
+    qint64 quota = 0;
+    qint64 period = 0;
+    const QList<QByteArray> cpuMax = ReadControlFile("/sys/fs/cgroup/cpu.max").split(' ');
+    if (cpuMax.count() == 2)
+    {
+        quota = cpuMax[0].toLongLong();
+        period = cpuMax[1].toLongLong();
+    }
+    else
+    {
+        // cgroup v1 uses -1 as quota when unlimited
+        quota = ReadControlFile("/sys/fs/cgroup/cpu/cpu.cfs_quota_us").toLongLong();
+        period = ReadControlFile("/sys/fs/cgroup/cpu/cpu.cfs_period_us").toLongLong();
+    }
+
+    if (quota <= 0 || period <= 0)
+        return 0;
+
+    return static_cast<int>(qMax<qint64>(1, (quota + period - 1) / period));
+}
+
+qint64 ResourceLimits::PeakResident()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef Q_OS_MACOS
+        return usage.ru_maxrss;
+#else
+        return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+    }
+#endif
+    return 0;
+}
+
+MemoryBudget::MemoryBudget(qint64 limit)
+    : m_limit(limit)
+{
+}
+
+bool MemoryBudget::TryAcquire(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_limit > 0 && m_used > 0 && m_used + bytes > m_limit)
+        return false;
+
+    m_used += bytes;
+    m_peak = qMax(m_peak, m_used);
+    return true;
+}
+
+void MemoryBudget::Acquire(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_used += bytes;
+    m_peak = qMax(m_peak, m_used);
+}
+
+void MemoryBudget::Release(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_used -= bytes;
+}
+
+qint64 MemoryBudget::Peak() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_peak;
+}
@@ -0,0 +1,71 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QMutex>
+
+// Limits imposed on the process by its environment, e.g. the cgroup of a CI container.
+class ResourceLimits
+{
+public:
+    // Memory available to the process in bytes, or 0 if not limited.
+    static qint64 Memory();
+
+    // Number of cores the process may keep busy, or 0 if not limited.
+    static int Cores();
+
+    // Most memory the process has had resident so far in bytes, or 0 if unknown.
+    static qint64 PeakResident();
+};
+
+// Accounts the estimated memory held by running work and buffered results against a budget. Work is only admitted
+// while it fits, work bigger than the whole budget is admitted on its own.
+class MemoryBudget
+{
+public:
+    // A limit of 0 admits everything.
+    explicit MemoryBudget(qint64 limit);
+
+    // Admits bytes if they fit in what is left of the budget, or if nothing else is admitted.
+    bool TryAcquire(qint64 bytes);
+
+    // Admits bytes whether they fit or not, for memory that is already in use or work others wait for.
+    void Acquire(qint64 bytes);
+
+    void Release(qint64 bytes);
+
+    // Highest estimated footprint admitted at once.
+    qint64 Peak() const;
+
+private:
+    const qint64 m_limit;
+    qint64 m_used = 0;
+    qint64 m_peak = 0;
+    mutable QMutex m_mutex;
+};
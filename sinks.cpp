@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QElapsedTimer>
+#include <QIODevice>
+
+#include "sinks.h"
+
+// Long output is encoded this many characters at a time, so its UTF-8 copy stays small.
+static const qsizetype BlockSize = 1 << 16;
+
+Utf8Sink::Utf8Sink(QIODevice& device)
+    : m_device(device)
+    , m_encoder(QStringEncoder::Utf8)
+{
+}
+
+bool Utf8Sink::Write(QStringView text)
+{
+    // The encoder keeps a surrogate pair split between two blocks together
+    for (qsizetype position = 0; position < text.size(); position += BlockSize)
+    {
+        const QByteArray bytes = m_encoder(text.mid(position, BlockSize));
+        if (m_device.write(bytes) != bytes.size())
+            return false;
+    }
+
+    return true;
+}
+
+CompareSink::CompareSink(QIODevice& source, Sink* next)
+    : m_source(source)
+    , m_next(next)
+    , m_encoder(QStringEncoder::Utf8)
+    , m_differs(false)
+{
+}
+
+bool CompareSink::Write(QStringView text)
+{
+    if (!m_differs)
+    {
+        const QByteArray bytes = m_encoder(text);
+        m_differs = m_source.read(bytes.size()) != bytes;
+    }
+
+    if (m_next != nullptr)
+        return m_next->Write(text);
+
+    return !m_differs;
+}
+
+bool CompareSink::Differs() const
+{
+    return m_differs;
+}
+
+bool CompareSink::Matches() const
+{
+    return !m_differs && m_source.atEnd();
+}
+
+DeadlineSink::DeadlineSink(Sink& next, const QElapsedTimer& timer, qint64 timeout)
+    : m_next(next)
+    , m_timer(timer)
+    , m_timeout(timeout)
+    , m_expired(false)
+{
+}
+
+bool DeadlineSink::Write(QStringView text)
+{
+    if (m_timeout > 0 && m_timer.elapsed() > m_timeout)
+    {
+        m_expired = true;
+        return false;
+    }
+
+    return m_next.Write(text);
+}
+
+bool DeadlineSink::Expired() const
+{
+    return m_expired;
+}
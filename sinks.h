@@ -0,0 +1,100 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <QByteArray>
+#include <QStringEncoder>
+#include <QStringView>
+
+class QElapsedTimer;
+class QIODevice;
+
+// Takes formatted output piece by piece as it is produced, so it never has to be held as a whole.
+class Sink
+{
+public:
+    virtual ~Sink() = default;
+
+    // Takes the next piece of output. Returns false if the sink does not want any more of it.
+    virtual bool Write(QStringView text) = 0;
+};
+
+// Writes output to a file or standard output as UTF-8, a block at a time.
+class Utf8Sink : public Sink
+{
+public:
+    explicit Utf8Sink(QIODevice& device);
+
+    bool Write(QStringView text) override;
+
+private:
+    QIODevice& m_device;
+    QStringEncoder m_encoder;
+};
+
+// Compares output with the source it was formatted from, read along with it, and passes it on to next if there
+// is one. Without a next sink it stops at the first difference, there is nothing more to learn from the rest.
+class CompareSink : public Sink
+{
+public:
+    explicit CompareSink(QIODevice& source, Sink* next = nullptr);
+
+    bool Write(QStringView text) override;
+
+    // True if the output so far differs from the source.
+    bool Differs() const;
+
+    // True if the output so far is all of the source.
+    bool Matches() const;
+
+private:
+    QIODevice& m_source;
+    Sink* m_next;
+    QStringEncoder m_encoder;
+    bool m_differs;
+};
+
+// Passes output on to next until timer is past timeout milliseconds, checked as every piece arrives, then stops
+// taking it. A timeout of 0 never expires.
+class DeadlineSink : public Sink
+{
+public:
+    DeadlineSink(Sink& next, const QElapsedTimer& timer, qint64 timeout);
+
+    bool Write(QStringView text) override;
+
+    // True if output was stopped because the time ran out.
+    bool Expired() const;
+
+private:
+    Sink& m_next;
+    const QElapsedTimer& m_timer;
+    const qint64 m_timeout;
+    bool m_expired;
+};
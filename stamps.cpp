@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2015-2020, Jesper Hellesø Hansen
+jesperhh@gmail.com
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+* Redistributions of source code must retain the above copyright
+notice, this list of conditions and the following disclaimer.
+* Redistributions in binary form must reproduce the above copyright
+notice, this list of conditions and the following disclaimer in the
+documentation and/or other materials provided with the distribution.
+* Neither the name of the <organization> nor the
+names of its contributors may be used to endorse or promote products
+derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QDateTime>
+#include <QFile>
+#include <QList>
+
+#include "stamps.h"
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_MACOS)
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#define QMLFMT_HAS_XATTR
+#endif
+
+#ifdef QMLFMT_HAS_XATTR
+
+static const char AttributeName[] = "user.qmlfmt";
+
+// Setting the attribute sets the change time to the time it was set, so a stamp holds that time instead of the
+// change time and is still current while the change time is within this many nanoseconds of it.
+static const qint64 ChangeTimeTolerance = 1000000000;
+
+// Modification time, size and change time of a file, empty if it cannot be read.
+static QList<qint64> FileTimes(const QByteArray& path)
+{
+    struct stat status;
+    if (stat(path.constData(), &status) != 0)
+        return QList<qint64>();
+
+#ifdef Q_OS_MACOS
+    const struct timespec& modified = status.st_mtimespec;
+    const struct timespec& changed = status.st_ctimespec;
+#else
+    const struct timespec& modified = status.st_mtim;
+    const struct timespec& changed = status.st_ctim;
+#endif
+    return QList<qint64>{
+        qint64(modified.tv_sec) * 1000000000 + modified.tv_nsec,
+        qint64(status.st_size),
+        qint64(changed.tv_sec) * 1000000000 + changed.tv_nsec };
+}
+
+bool Stamp::IsCurrent(const QString& path, const QByteArray& fingerprint)
+{
+    const QByteArray fileName = QFile::encodeName(path);
+    char value[256];
+#ifdef Q_OS_MACOS
+    const ssize_t length = getxattr(fileName.constData(), AttributeName, value, sizeof(value), 0, 0);
+#else
+    const ssize_t length = getxattr(fileName.constData(), AttributeName, value, sizeof(value));
+#endif
+    if (length <= 0)
+        return false;
+
+    // "<fingerprint> <modified> <size> <changed>"
+    const QList<QByteArray> fields = QByteArray(value, length).split(' ');
+    const QList<qint64> times = FileTimes(fileName);
+    if (fields.count() != 4 || times.isEmpty() || fields[0] != fingerprint)
+        return false;
+
+    const qint64 stamped = fields[3].toLongLong();
+    return fields[1].toLongLong() == times[0] && fields[2].toLongLong() == times[1] &&
+        qAbs(times[2] - stamped) < ChangeTimeTolerance;
+}
+
+QList<qint64> Stamp::Times(const QString& path)
+{
+    return FileTimes(QFile::encodeName(path));
+}
+
+void Stamp::Write(const QString& path, const QByteArray& fingerprint, const QList<qint64>& times)
+{
+    // A file changed after it was read or written may not be formatted any more
+    const QByteArray fileName = QFile::encodeName(path);
+    if (times.isEmpty() || FileTimes(fileName) != times)
+        return;
+
+    const qint64 stamped = QDateTime::currentMSecsSinceEpoch() * 1000000;
+    const QByteArray value = fingerprint + ' ' + QByteArray::number(times[0]) + ' ' + QByteArray::number(times[1]) + ' ' +
+        QByteArray::number(stamped);
+
+    // Filesystems without extended attributes just fail, the file is formatted again next time
+#ifdef Q_OS_MACOS
+    setxattr(fileName.constData(), AttributeName, value.constData(), value.size(), 0, 0);
+#else
+    setxattr(fileName.constData(), AttributeName, value.constData(), value.size(), 0);
+#endif
+}
+
+#else
+
+bool Stamp::IsCurrent(const QString&, const QByteArray&)
+{
+    return false;
+}
+
+QList<qint64> Stamp::Times(const QString&)
+{
+    return QList<qint64>();
+}
+
+void Stamp::Write(const QString&, const QByteArray&, const QList<qint64>&)
+{
+}
+
+#endif
@@ -31,6 +31,7 @@
 #include <QtTest>
 #include <QRegExp>
 #include <diff_match_patch.h>
+#include <costhistory.h>
 
 TestRunner::TestRunner(const QString& qmlfmtPath, QObject *parent) : m_qmlfmtPath(qmlfmtPath)
 {
@@ -163,6 +164,199 @@ void TestRunner::DiffWithFormatted()
     }
 }
 
+void TestRunner::DiffWithExhaustedBudget()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QFETCH(bool, hasError);
+
+    if (hasError)
+        QSKIP("Covered by DiffWithFormatted");
+
+    // A budget of one cell forces the line based fallback, which must still produce a valid patch. The token
+    // alignment never runs out of budget, so the character diff is asked for.
+    m_process->setArguments({ input, "-d", "--diff-budget", "1", "--diff-algorithm", "myers" });
+    m_process->start();
+    QString diff = readOutputStream(false);
+    QVERIFY(m_process->exitCode() == 0);
+
+    diff_match_patch differ;
+    QList<Patch> patch = differ.patch_fromText(diff);
+    QString patchedUnformatted = differ.patch_apply(patch, readFile(input)).first;
+    QCOMPARE(patchedUnformatted, readFile(expected));
+}
+
+void TestRunner::DiffWithAlgorithm_data()
+{
+    QTest::addColumn<QString>("algorithm");
+    QTest::addColumn<QString>("input");
+    QTest::addColumn<QString>("expected");
+
+    for (const QString& algorithm : QStringList{ "tokens", "myers", "patience", "histogram" })
+    {
+        for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+        {
+            if (!iter->first.contains("error"))
+                QTest::newRow((algorithm + "_" + QFileInfo(iter->first).baseName()).toLatin1()) << algorithm << iter->first << iter->second;
+        }
+    }
+}
+
+void TestRunner::DiffWithAlgorithm()
+{
+    QFETCH(QString, algorithm);
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+
+    m_process->setArguments({ input, "-d", "--diff-algorithm", algorithm });
+    m_process->start();
+    QString diff = readOutputStream(false);
+    QVERIFY(m_process->exitCode() == 0);
+
+    diff_match_patch differ;
+    QList<Patch> patch = differ.patch_fromText(diff);
+    QString patchedUnformatted = differ.patch_apply(patch, readFile(input)).first;
+    QCOMPARE(patchedUnformatted, readFile(expected));
+}
+
+void TestRunner::DiffHugeFileWithJobs()
+{
+    // Past 10000 lines patience splits the diff at its anchors and diffs the ranges between them concurrently,
+    // which must give the same patch however many threads there are
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 12000; index++)
+        content += QString(index % 5 == 0 ? "    property int p%1 :  %1\n" : "    property int p%1: %1\n").arg(index);
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName });
+    m_process->start();
+    const QString formatted = readOutputStream(false);
+
+    QString diffs[2];
+    const QStringList jobs = { "1", "4" };
+    for (int run = 0; run < 2; run++)
+    {
+        m_process->setArguments({ temporaryFileName, "-d", "--diff-algorithm", "patience", "-j", jobs[run] });
+        m_process->start();
+        diffs[run] = readOutputStream(false);
+        QVERIFY(m_process->exitCode() == 0);
+    }
+
+    QCOMPARE(diffs[1], diffs[0]);
+
+    diff_match_patch differ;
+    QList<Patch> patch = differ.patch_fromText(diffs[0]);
+    QCOMPARE(differ.patch_apply(patch, content).first, formatted);
+}
+
+void TestRunner::DiffSplitLikeUnsplit_data()
+{
+    QTest::addColumn<int>("algorithm");
+    QTest::addColumn<qint64>("budget");
+
+    QTest::newRow("patience") << int(PATIENCE) << qint64(50000000);
+    QTest::newRow("histogram") << int(HISTOGRAM) << qint64(50000000);
+
+    // Too little budget for the ranges together, they are diffed again one after the other
+    QTest::newRow("patience_exhausted") << int(PATIENCE) << qint64(2000);
+    QTest::newRow("histogram_exhausted") << int(HISTOGRAM) << qint64(2000);
+}
+
+void TestRunner::DiffSplitLikeUnsplit()
+{
+    QFETCH(int, algorithm);
+    QFETCH(qint64, budget);
+
+    // Unique lines to split at, with changed, deleted and added lines between them, and runs of the same lines
+    // that only bisecting lines up
+    QString text1;
+    QString text2;
+    for (int index = 0; index < 30000; index++)
+    {
+        const QString line = QString("    property int p%1: %1\n").arg(index);
+        text1 += line;
+        if (index % 13 == 0)
+            text2 += QString("    property int p%1:  %1\n").arg(index);
+        else if (index % 97 != 0)
+            text2 += line;
+
+        if (index % 89 == 0)
+            text2 += "    // added\n";
+
+        if (index % 50 == 0)
+        {
+            text1 += "    }\n    }\n\n    }\n";
+            text2 += "    }\n\n    }\n    }\n    }\n";
+        }
+    }
+
+    diff_match_patch differ;
+    differ.Diff_Algorithm = static_cast<DiffAlgorithm>(algorithm);
+    differ.Diff_Budget = budget;
+    differ.Diff_ParallelLines = 0;
+    const QString unsplit = differ.patch_toText(differ.patch_make(text1, differ.diff_main(text1, text2)));
+
+    differ.Diff_ParallelLines = 1000;
+    const QString split = differ.patch_toText(differ.patch_make(text1, differ.diff_main(text1, text2)));
+
+    QCOMPARE(split, unsplit);
+
+    QList<Patch> patch = differ.patch_fromText(split);
+    QCOMPARE(differ.patch_apply(patch, text1).first, text2);
+}
+
+void TestRunner::EditsAsJson()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QFETCH(bool, hasError);
+
+    if (hasError)
+        QSKIP("Covered by DiffWithFormatted");
+
+    m_process->setArguments({ input, "--edits", "json" });
+    m_process->start();
+    QString output = readOutputStream(false);
+    QVERIFY(m_process->exitCode() == 0);
+
+    QJsonObject result = QJsonDocument::fromJson(output.toUtf8()).object();
+    QCOMPARE(result["file"].toString(), input);
+
+    // Apply the edits back to front, so earlier offsets stay valid
+    QString edited = readFile(input);
+    const QJsonArray edits = result["edits"].toArray();
+    for (int i = edits.size() - 1; i >= 0; i--)
+    {
+        const QJsonObject edit = edits[i].toObject();
+        edited.replace(edit["offset"].toInt(), edit["length"].toInt(), edit["replacement"].toString());
+    }
+
+    QCOMPARE(edited, readFile(expected));
+}
+
+void TestRunner::SyntaxCheck()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QFETCH(bool, hasError);
+
+    // Errors are printed as with -e, files that parse print nothing
+    m_process->setArguments({ input, "--syntax-check" });
+    m_process->start();
+    QString stdOut = readOutputStream(false);
+    QString stdError = readOutputStream(true);
+
+    QCOMPARE(stdOut, QString());
+    QCOMPARE(stdError, hasError ? readFile(expected) : QString());
+    QCOMPARE(m_process->exitCode(), hasError ? 1 : 0);
+}
+
 void TestRunner::FormatFileOverwrite()
 {
     QFETCH(QString, input);
@@ -181,6 +375,28 @@ void TestRunner::FormatFileOverwrite()
     QCOMPARE(formattedQml, expectedQml);
 }
 
+void TestRunner::FormatIdenticalFilesOverwrite()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QFETCH(bool, hasError);
+
+    // Identical files are formatted once, but every one of them is written
+    QString firstFileName = getTemporaryFileName();
+    QString secondFileName = getTemporaryFileName();
+    QVERIFY(QFile::copy(input, firstFileName));
+    QVERIFY(QFile::copy(input, secondFileName));
+
+    m_process->setArguments({ firstFileName, secondFileName, "-w", "-e" });
+    m_process->start();
+    QString stdError = readOutputStream(true);
+
+    QString expectedQml = readFile(hasError ? input : expected);
+    QCOMPARE(readFile(firstFileName), expectedQml);
+    QCOMPARE(readFile(secondFileName), expectedQml);
+    QCOMPARE(stdError, hasError ? readFile(expected) + readFile(expected) : QString());
+}
+
 void TestRunner::FormatFileToStdOut()
 {
     QFETCH(QString, input);
@@ -193,6 +409,19 @@ void TestRunner::FormatFileToStdOut()
     QCOMPARE(output, readFile(expected));
 }
 
+void TestRunner::FormatFileInChunks()
+{
+    QFETCH(QString, input);
+    QFETCH(QString, expected);
+    QFETCH(bool, hasError);
+
+    // Every file is past the threshold and split wherever it can be, which must not change the result
+    m_process->setArguments({ input, "-e", "--stream-threshold", "1" });
+    m_process->start();
+    QString output = readOutputStream(hasError);
+    QCOMPARE(output, readFile(expected));
+}
+
 void TestRunner::FormatStdInToStdOut()
 {
     QFETCH(QString, input);
@@ -260,6 +489,653 @@ void TestRunner::PrintMultipleFilesWithDifferences()
     QCOMPARE(stdError, errors);
 }
 
+void TestRunner::PrintMultipleFilesWithWorkers()
+{
+    // Same as formatting in threads, results are printed in the order the files were given
+    QStringList arguments = { "-l", "-e", "--workers", "2" };
+    QString changedFiles, errors;
+    for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+    {
+        arguments.append(iter->first);
+        if (iter->first.contains("error"))
+        {
+            errors.append(readFile(iter->second));
+        }
+        else
+        {
+            changedFiles.append(iter->first + "\n");
+        }
+    }
+
+    m_process->setArguments(arguments);
+    m_process->start();
+
+    QString stdOut = readOutputStream(false);
+    QString stdError = readOutputStream(true);
+    QCOMPARE(stdOut, changedFiles);
+    QCOMPARE(stdError, errors);
+}
+
+void TestRunner::FormatAfterWorkerCrash()
+{
+    // The biggest valid file crashes its worker. It is formatted first, the files after it get a new worker.
+    QString crashFile;
+    for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+    {
+        if (!iter->first.contains("error") && (crashFile.isEmpty() || QFileInfo(iter->first).size() > QFileInfo(crashFile).size()))
+            crashFile = iter->first;
+    }
+
+    QStringList arguments = { "-l", "-e", "--workers", "1" };
+    QString changedFiles, errors;
+    for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+    {
+        arguments.append(iter->first);
+        if (iter->first == crashFile)
+        {
+            errors.append("Worker crashed formatting " + crashFile + "\n");
+        }
+        else if (iter->first.contains("error"))
+        {
+            errors.append(readFile(iter->second));
+        }
+        else
+        {
+            changedFiles.append(iter->first + "\n");
+        }
+    }
+
+    QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+    environment.insert("QMLFMT_WORKER_CRASH_ON", QFileInfo(crashFile).fileName());
+    m_process->setProcessEnvironment(environment);
+    m_process->setArguments(arguments);
+    m_process->start();
+
+    QString stdOut = readOutputStream(false);
+    QString stdError = readOutputStream(true);
+    QCOMPARE(m_process->exitCode(), 1);
+    QCOMPARE(stdOut, changedFiles);
+    QCOMPARE(stdError, errors);
+}
+
+void TestRunner::PrintMultipleFilesWithinMemoryBudget()
+{
+    // No two files fit in the budget at once, they are still all formatted and printed in order
+    QStringList arguments = { "-j", "4", "--max-memory", "1" };
+    QString expected;
+    for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+    {
+        if (!iter->first.contains("error"))
+        {
+            arguments.append(iter->first);
+            expected.append(readFile(iter->second));
+        }
+    }
+
+    m_process->setArguments(arguments);
+    m_process->start();
+    QCOMPARE(readOutputStream(false), expected);
+    QCOMPARE(m_process->exitCode(), 0);
+}
+
+void TestRunner::ShardsListEveryFileOnce()
+{
+    QStringList files;
+    for (auto iter = m_testFiles.cbegin(); iter != m_testFiles.cend(); iter++)
+        files.append(iter->first);
+
+    m_process->setArguments(QStringList{ "-l" } + files);
+    m_process->start();
+    QStringList expected = readOutputStream(false).split("\n", Qt::SkipEmptyParts);
+
+    QStringList listed;
+    const int shards = 3;
+    for (int shard = 0; shard < shards; shard++)
+    {
+        m_process->setArguments(QStringList{ "-l", "--shard", QString("%1/%2").arg(shard).arg(shards) } + files);
+        m_process->start();
+        listed.append(readOutputStream(false).split("\n", Qt::SkipEmptyParts));
+    }
+
+    expected.sort();
+    listed.sort();
+    QCOMPARE(listed, expected);
+}
+
+void TestRunner::ListChangedFileWithStamps()
+{
+    QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
+    sourceDir.cd("data");
+    QString temporaryFileName = getTemporaryFileName();
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("out_basic.qml"), temporaryFileName));
+
+    // Formatted files are not listed, whether they were stamped or not
+    for (int run = 0; run < 2; run++)
+    {
+        m_process->setArguments({ temporaryFileName, "-l", "--stamps" });
+        m_process->start();
+        QCOMPARE(readOutputStream(false), QString());
+    }
+
+    // A stamp does not hide changes made after it
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(readFile(sourceDir.absoluteFilePath("in_basic.qml")).toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "-l", "--stamps" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), temporaryFileName + "\n");
+}
+
+void TestRunner::RecordCostHistory()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
+    sourceDir.cd("data");
+    QDir tree(directory.path());
+    QVERIFY(tree.mkdir("tree"));
+    QVERIFY(tree.cd("tree"));
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("out_basic.qml"), tree.filePath("a.qml")));
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("out_basic.qml"), tree.filePath("b.qml")));
+    const QString historyFileName = QDir(directory.path()).filePath("history.json");
+
+    const auto readHistory = [&historyFileName]() {
+        QFile file(historyFileName);
+        file.open(QFile::ReadOnly);
+        return QJsonDocument::fromJson(file.readAll()).object();
+    };
+
+    // Only one of the identical files is formatted, the other takes its result and is not measured
+    m_process->setArguments({ tree.path(), "-l", "--stamps", "--cost-history", historyFileName });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), QString());
+
+    QJsonObject history = readHistory();
+    QCOMPARE(history["version"].toInt(), 1);
+    QCOMPARE(history["generation"].toInteger(), 1);
+    QJsonArray entries = history["entries"].toArray();
+    QCOMPARE(entries.size(), 1);
+    const QJsonObject entry = entries[0].toObject();
+    QVERIFY(entry["path"].toString().endsWith("a.qml") || entry["path"].toString().endsWith("b.qml"));
+    QCOMPARE(entry["hash"].toString().size(), 40);
+    QCOMPARE(entry["size"].toInteger(), QFileInfo(tree.filePath("a.qml")).size());
+    QVERIFY(entry["cost"].toInteger() > 0);
+    QCOMPARE(entry["used"].toInteger(), 1);
+
+    // Files skipped for their stamps are not formatted, their entries are left as they were
+    m_process->setArguments({ tree.path(), "-l", "--stamps", "--cost-history", historyFileName });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), QString());
+
+    history = readHistory();
+    QCOMPARE(history["generation"].toInteger(), 2);
+    entries = history["entries"].toArray();
+    QCOMPARE(entries.size(), 1);
+    if (entries[0].toObject()["used"].toInteger() == 2)
+        QSKIP("Extended attributes are not supported, files are not stamped");
+    QCOMPARE(entries[0].toObject(), entry);
+}
+
+void TestRunner::TrimCostHistory()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString historyFileName = QDir(directory.path()).filePath("history.json");
+
+    // One entry more than are kept, the oldest is dropped on saving
+    QJsonArray entries;
+    for (int index = 0; index <= 50000; index++)
+        entries.append(QJsonObject{ { "path", QString("%1.qml").arg(index) }, { "hash", "00" }, { "size", 100 }, { "cost", 1000 }, { "used", index } });
+
+    QFile file(historyFileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(QJsonDocument(QJsonObject{ { "version", 1 }, { "generation", 50000 }, { "entries", entries } }).toJson());
+    file.close();
+
+    CostHistory history;
+    history.Load(historyFileName);
+    QVERIFY(history.Save(historyFileName));
+
+    QVERIFY(file.open(QFile::ReadOnly));
+    const QJsonObject saved = QJsonDocument::fromJson(file.readAll()).object();
+    QCOMPARE(saved["generation"].toInteger(), 50001);
+    entries = saved["entries"].toArray();
+    QCOMPARE(entries.size(), 50000);
+    for (const QJsonValue& entry : entries)
+        QVERIFY(entry.toObject()["path"].toString() != "0.qml");
+}
+
+void TestRunner::DiscardCostHistoryOfOtherVersion()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString historyFileName = QDir(directory.path()).filePath("history.json");
+
+    QJsonArray entries;
+    entries.append(QJsonObject{ { "path", "a.qml" }, { "hash", "00" }, { "size", 100 }, { "cost", 100000 }, { "used", 1 } });
+    QFile file(historyFileName);
+    QVERIFY(file.open(QFile::WriteOnly));
+    file.write(QJsonDocument(QJsonObject{ { "version", 2 }, { "generation", 1 }, { "entries", entries } }).toJson());
+    file.close();
+
+    // The file is estimated as if it had no history, as is any file of the same size
+    CostHistory history;
+    history.Load(historyFileName);
+    QCOMPARE(history.Estimate("a.qml", 100), history.Estimate("b.qml", 100));
+}
+
+void TestRunner::EstimateFromCostHistory()
+{
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString historyFileName = QDir(directory.path()).filePath("history.json");
+
+    // A file's own cost scales with its size, the same content measured again is averaged
+    CostHistory history;
+    history.Record("a.qml", "hash", 1000, 5000);
+    QCOMPARE(history.Estimate("a.qml", 2000), 10000);
+    history.Record("a.qml", "hash", 1000, 7000);
+    QCOMPARE(history.Estimate("a.qml", 1000), 6000);
+
+    // Changed content replaces the measurement
+    history.Record("a.qml", "other", 1000, 3000);
+    QCOMPARE(history.Estimate("a.qml", 1000), 3000);
+
+    // Files without history are estimated from the average cost per byte of the loaded history
+    QVERIFY(history.Save(historyFileName));
+    CostHistory loaded;
+    loaded.Load(historyFileName);
+    QCOMPARE(loaded.Estimate("a.qml", 1000), 3000);
+    QCOMPARE(loaded.Estimate("b.qml", 500), 1500);
+}
+
+void TestRunner::ListLargeFile()
+{
+    // Big enough to be checked chunk by chunk, with the only change in the last chunk
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 4000; index++)
+        content += QString("    Item {\n        width: %1\n    }\n").arg(index);
+    content += "    Item {\n        width:    4000\n    }\n}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "-l" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), temporaryFileName + "\n");
+}
+
+void TestRunner::ListLargeFileWithLaterError_data()
+{
+    QTest::addColumn<QString>("threshold");
+    QTest::addColumn<bool>("listed");
+    QTest::addColumn<int>("exitCode");
+
+    // Checked chunk by chunk, the error after the first change goes unreported and the file is listed
+    QTest::newRow("chunked") << QString("8M") << true << 0;
+    QTest::newRow("whole") << QString("0") << false << 1;
+}
+
+void TestRunner::ListLargeFileWithLaterError()
+{
+    QFETCH(QString, threshold);
+    QFETCH(bool, listed);
+    QFETCH(int, exitCode);
+
+    // Big enough to be checked chunk by chunk, changed in the first chunk and broken in the last one
+    QString content = "import QtQuick 2.5\n\nItem {\n    Item {\n        width:    0\n    }\n";
+    for (int index = 1; index < 4000; index++)
+        content += QString("    Item {\n        width: %1\n    }\n").arg(index);
+    content += "    Item {\n        width: ]\n    }\n}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "-l", "--stream-threshold", threshold });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), listed ? temporaryFileName + "\n" : QString());
+    QCOMPARE(m_process->exitCode(), exitCode);
+}
+
+void TestRunner::FormatRepeatedMembersInChunks()
+{
+    // Repeated members big enough to be cached are formatted once and reused, which must come out the same as
+    // formatting all of them. The small ones in between are formatted with the members around them.
+    QString rectangle = "  Rectangle {\n  color:   \"red\"\n";
+    for (int line = 0; line < 40; line++)
+        rectangle += QString("    property int value%1:   %1\n").arg(line);
+    rectangle += "    Text { text: qsTr(\"Hello\") }\n  }\n";
+
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; index < 200; index++)
+    {
+        content += rectangle;
+        content += QString("  PropertyChanges { target: item%1;   visible: false }\n").arg(index % 3);
+    }
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "--stream-threshold", "0" });
+    m_process->start();
+    const QString expected = readOutputStream(false);
+
+    m_process->setArguments({ temporaryFileName, "--stream-threshold", "1" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), expected);
+}
+
+void TestRunner::FormatLargeFileOnAllCores()
+{
+    // From a megabyte by default the file is formatted in chunks in parallel, which must come out the same as
+    // formatting it whole
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; content.size() < (1 << 20) + (1 << 16); index++)
+    {
+        content += QString("    Item { id: item%1; width: %1 // Item %1\n").arg(index);
+        content += QString("        function area() { return width*%1 }\n    }\n").arg(index % 7);
+    }
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "--stream-threshold", "0" });
+    m_process->start();
+    const QString expected = readOutputStream(false);
+
+    // The capture's sidecar tells how many chunks the file was formatted in
+    const QString name = QCryptographicHash::hash(content.toUtf8(), QCryptographicHash::Sha1).toHex() + ".qml.json";
+    const auto chunks = [&](const QStringList& arguments) {
+        QTemporaryDir captureDir;
+        m_process->setArguments(QStringList{ temporaryFileName, "-j", "4", "--capture-slow", "1", "--capture-dir",
+            captureDir.path() } + arguments);
+        m_process->start();
+        if (readOutputStream(false) != expected)
+            return -1;
+
+        QFile sidecarFile(captureDir.filePath(name));
+        sidecarFile.open(QFile::ReadOnly);
+        return QJsonDocument::fromJson(sidecarFile.readAll()).object()["chunks"].toInt();
+    };
+
+    QVERIFY(chunks({}) > 1);
+
+    // A threshold given by the user holds for parallel formatting too
+    QCOMPARE(chunks({ "--stream-threshold", "64M" }), 1);
+}
+
+void TestRunner::OverwriteLargeFileWithTimeout()
+{
+    // Files formatted in chunks are given up on past the file timeout too, and left as they were
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; content.size() < (1 << 20) + (1 << 16); index++)
+        content += QString("    Item {   width: %1 }\n").arg(index);
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "-w", "--file-timeout", "1" });
+    m_process->start();
+    QVERIFY(readOutputStream(true).startsWith("Timed out formatting " + temporaryFileName));
+    QCOMPARE(m_process->exitCode(), 1);
+    QCOMPARE(readFile(temporaryFileName), content);
+}
+
+void TestRunner::DiffLargeFileWithTimeout()
+{
+    // Files are formatted in workers with a file timeout, which are stopped as soon as it is up
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; content.size() < (1 << 20); index++)
+        content += QString("    Item {   width: %1 }\n").arg(index);
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    m_process->setArguments({ temporaryFileName, "-d", "--file-timeout", "1" });
+    m_process->start();
+    QVERIFY(readOutputStream(true).startsWith("Timed out formatting " + temporaryFileName + " after "));
+    QCOMPARE(readOutputStream(false), QString());
+    QCOMPARE(m_process->exitCode(), 1);
+}
+
+void TestRunner::FormatStdInWithTimeout()
+{
+    // Standard input is formatted as a whole in this process, and given up on once the step past the timeout is done
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; content.size() < (1 << 20); index++)
+        content += QString("    Item {   width: %1 }\n").arg(index);
+    content += "}\n";
+
+    m_process->setArguments({ "--file-timeout", "1" });
+    m_process->start();
+    QVERIFY(m_process->waitForStarted());
+
+    m_process->write(content.toUtf8());
+    m_process->closeWriteChannel();
+    QVERIFY(readOutputStream(true).startsWith("Timed out formatting stdin.qml after "));
+    QCOMPARE(readOutputStream(false), QString());
+    QCOMPARE(m_process->exitCode(), 1);
+}
+
+void TestRunner::CaptureSlowFile_data()
+{
+    QTest::addColumn<QStringList>("arguments");
+    QTest::addColumn<bool>("crash");
+    QTest::addColumn<QString>("outcome");
+
+    QTest::newRow("thread") << QStringList() << false << QString("done");
+    QTest::newRow("worker_timed_out") << QStringList{ "--workers", "1", "--file-timeout", "1" } << false << QString("timedOut");
+    QTest::newRow("worker_crashed") << QStringList{ "--workers", "1" } << true << QString("crashed");
+}
+
+void TestRunner::CaptureSlowFile()
+{
+    QFETCH(QStringList, arguments);
+    QFETCH(bool, crash);
+    QFETCH(QString, outcome);
+
+    // Parsing a megabyte takes well over a millisecond
+    QString content = "import QtQuick 2.5\n\nItem {\n";
+    for (int index = 0; content.size() < (1 << 20); index++)
+        content += QString("    Item {   width: %1 }\n").arg(index);
+    content += "}\n";
+
+    QString temporaryFileName = getTemporaryFileName();
+    QFile file(temporaryFileName);
+    QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+    file.write(content.toUtf8());
+    file.close();
+
+    QTemporaryDir captureDir;
+    QVERIFY(captureDir.isValid());
+    if (crash)
+    {
+        QProcessEnvironment environment = QProcessEnvironment::systemEnvironment();
+        environment.insert("QMLFMT_WORKER_CRASH_ON", QFileInfo(temporaryFileName).fileName());
+        m_process->setProcessEnvironment(environment);
+    }
+
+    m_process->setArguments(QStringList{ temporaryFileName, "--syntax-check", "--capture-slow", "1", "--capture-dir", captureDir.path() } + arguments);
+    m_process->start();
+    QVERIFY(m_process->waitForFinished());
+
+    // The copy is named by the SHA-1 of its content, its sidecar after the copy
+    const QString name = QCryptographicHash::hash(content.toUtf8(), QCryptographicHash::Sha1).toHex() + ".qml";
+    QCOMPARE(readFile(captureDir.filePath(name)), content);
+
+    QFile sidecarFile(captureDir.filePath(name + ".json"));
+    QVERIFY(sidecarFile.open(QFile::ReadOnly));
+    const QJsonObject sidecar = QJsonDocument::fromJson(sidecarFile.readAll()).object();
+    QCOMPARE(sidecar["file"].toString(), temporaryFileName);
+    QCOMPARE(sidecar["size"].toInteger(), qint64(content.toUtf8().size()));
+    QCOMPARE(sidecar["outcome"].toString(), outcome);
+    QVERIFY(sidecar["parseMs"].isDouble());
+    QVERIFY(sidecar["reformatMs"].isDouble());
+    if (outcome == "done")
+        QVERIFY(sidecar["parseMs"].toDouble() > 1);
+
+    QVERIFY(!sidecar["version"].toString().isEmpty());
+    const QJsonObject options = sidecar["options"].toObject();
+    QCOMPARE(options["indent"].toInt(), 4);
+    QCOMPARE(options["tabSize"].toInt(), 4);
+    QCOMPARE(options["lineLength"].toInt(), 80);
+    QVERIFY(options["arguments"].toArray().contains(QJsonValue("--syntax-check")));
+}
+
+void TestRunner::OverwriteStagedFile()
+{
+    QTemporaryDir repository;
+    QVERIFY(repository.isValid());
+    if (QProcess::execute("git", { "-C", repository.path(), "init", "-q" }) != 0)
+        QSKIP("git is not available");
+
+    // The staged content is formatted, whatever is on disk
+    QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
+    sourceDir.cd("data");
+    const QString fileName = QDir(repository.path()).filePath("basic.qml");
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("in_basic.qml"), fileName));
+    QCOMPARE(QProcess::execute("git", { "-C", repository.path(), "add", "basic.qml" }), 0);
+    QVERIFY(QFile::remove(fileName));
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("out_basic.qml"), fileName));
+
+    m_process->setWorkingDirectory(repository.path());
+    m_process->setArguments({ "-l", "--git-staged" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), QString("basic.qml\n"));
+
+    // -w updates the index only
+    m_process->setArguments({ "-w", "--git-staged" });
+    m_process->start();
+    QVERIFY(m_process->waitForFinished());
+
+    QProcess git;
+    git.start("git", { "-C", repository.path(), "show", ":basic.qml" });
+    QVERIFY(git.waitForFinished());
+    QCOMPARE(QString::fromUtf8(git.readAllStandardOutput()).replace("\r", ""), readFile(sourceDir.absoluteFilePath("out_basic.qml")));
+    QCOMPARE(readFile(fileName), readFile(sourceDir.absoluteFilePath("out_basic.qml")));
+}
+
+void TestRunner::ListStagedFileNextToSubmodule()
+{
+    QTemporaryDir repository;
+    QVERIFY(repository.isValid());
+    if (QProcess::execute("git", { "-C", repository.path(), "init", "-q" }) != 0)
+        QSKIP("git is not available");
+
+    QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
+    sourceDir.cd("data");
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("in_basic.qml"), QDir(repository.path()).filePath("basic.qml")));
+    QCOMPARE(QProcess::execute("git", { "-C", repository.path(), "add", "basic.qml" }), 0);
+
+    // A submodule has no blob in this repository, even when its name looks like a QML file
+    QCOMPARE(QProcess::execute("git", { "-C", repository.path(), "update-index", "--add", "--cacheinfo",
+        "160000,1234567890123456789012345678901234567890,module.qml" }), 0);
+
+    m_process->setWorkingDirectory(repository.path());
+    m_process->setArguments({ "-l", "--git-staged" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), QString("basic.qml\n"));
+    QCOMPARE(m_process->exitCode(), 0);
+}
+
+void TestRunner::ListChangedSinceRef()
+{
+    QTemporaryDir repository;
+    QVERIFY(repository.isValid());
+    const QStringList git = { "-C", repository.path(), "-c", "user.name=qmlfmt", "-c", "user.email=qmlfmt@example.com" };
+    if (QProcess::execute("git", git + QStringList{ "init", "-q" }) != 0)
+        QSKIP("git is not available");
+
+    // Both files need formatting, only the one committed after the base is listed
+    QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
+    sourceDir.cd("data");
+    QDir repositoryDir(repository.path());
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("in_basic.qml"), repositoryDir.filePath("old.qml")));
+    QCOMPARE(QProcess::execute("git", git + QStringList{ "add", "old.qml" }), 0);
+    QCOMPARE(QProcess::execute("git", git + QStringList{ "commit", "-q", "-m", "old" }), 0);
+    QCOMPARE(QProcess::execute("git", git + QStringList{ "tag", "base" }), 0);
+    QVERIFY(QFile::copy(sourceDir.absoluteFilePath("in_basic.qml"), repositoryDir.filePath("new.qml")));
+    QCOMPARE(QProcess::execute("git", git + QStringList{ "add", "new.qml" }), 0);
+    QCOMPARE(QProcess::execute("git", git + QStringList{ "commit", "-q", "-m", "new" }), 0);
+
+    m_process->setWorkingDirectory(repository.path());
+    m_process->setArguments({ "-l", "--changed-since", "base" });
+    m_process->start();
+    QCOMPARE(readOutputStream(false), QString("./new.qml\n"));
+}
+
+void TestRunner::WatchFormatsChangedFileOnce()
+{
+    auto iter = m_testFiles.cbegin();
+    while (iter->first.contains("error"))
+        iter++;
+
+    QTemporaryDir directory;
+    QVERIFY(directory.isValid());
+    const QString path = directory.filePath("watched.qml");
+    const auto writeFile = [&path](const QString& content) {
+        QFile file(path);
+        QVERIFY(file.open(QFile::WriteOnly | QFile::Truncate));
+        file.write(content.toUtf8());
+    };
+    const auto readWatched = [&path]() {
+        QFile file(path);
+        file.open(QFile::ReadOnly | QFile::Text);
+        return QString::fromUtf8(file.readAll());
+    };
+
+    // Every round of formatting reports its memory use once
+    QString errors;
+    const auto rounds = [&]() {
+        errors += QString::fromUtf8(m_process->readAllStandardError());
+        return errors.count("Peak estimated memory use");
+    };
+
+    writeFile(readFile(iter->second));
+    m_process->setArguments({ "--watch", directory.path(), "-w", "--max-memory", "0" });
+    m_process->start();
+    QVERIFY(m_process->waitForStarted());
+    QTRY_COMPARE_WITH_TIMEOUT(rounds(), 1, 10000);
+
+    // Give the watch time to start after the first round
+    QTest::qWait(500);
+    writeFile(readFile(iter->first));
+    QTRY_COMPARE_WITH_TIMEOUT(rounds(), 2, 10000);
+    QCOMPARE(readWatched(), readFile(iter->second));
+
+    // qmlfmt writing the file is not taken for another change
+    QTest::qWait(2000);
+    QCOMPARE(rounds(), 2);
+    QCOMPARE(readWatched(), readFile(iter->second));
+
+    m_process->kill();
+    m_process->waitForFinished();
+}
+
 void TestRunner::FormatWithDifferentTabAndIndentSize()
 {
     QDir sourceDir = QFileInfo(QFile::decodeName(__FILE__)).absoluteDir();
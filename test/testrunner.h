@@ -61,17 +61,63 @@ private slots:
     void DiffWithFormatted();
     void DiffWithFormatted_data() { prepareTestData(); }
 
+    void DiffWithExhaustedBudget();
+    void DiffWithExhaustedBudget_data() { prepareTestData(); }
+
+    void DiffWithAlgorithm();
+    void DiffWithAlgorithm_data();
+
+    void DiffHugeFileWithJobs();
+
+    void DiffSplitLikeUnsplit();
+    void DiffSplitLikeUnsplit_data();
+
+    void EditsAsJson();
+    void EditsAsJson_data() { prepareTestData(); }
+
+    void SyntaxCheck();
+    void SyntaxCheck_data() { prepareTestData(); }
+
     void FormatFileOverwrite();
     void FormatFileOverwrite_data() { prepareTestData(); }
 
+    void FormatIdenticalFilesOverwrite();
+    void FormatIdenticalFilesOverwrite_data() { prepareTestData(); }
+
     void FormatFileToStdOut();
     void FormatFileToStdOut_data() { prepareTestData(); }
 
+    void FormatFileInChunks();
+    void FormatFileInChunks_data() { prepareTestData(); }
+
     void FormatStdInToStdOut();
     void FormatStdInToStdOut_data() { prepareTestData(); }
 
     void PrintFolderWithDifferences();
     void PrintMultipleFilesWithDifferences();
+    void PrintMultipleFilesWithWorkers();
+    void FormatAfterWorkerCrash();
+    void PrintMultipleFilesWithinMemoryBudget();
+    void ShardsListEveryFileOnce();
+    void ListChangedFileWithStamps();
+    void RecordCostHistory();
+    void TrimCostHistory();
+    void DiscardCostHistoryOfOtherVersion();
+    void EstimateFromCostHistory();
+    void ListLargeFile();
+    void ListLargeFileWithLaterError_data();
+    void ListLargeFileWithLaterError();
+    void FormatRepeatedMembersInChunks();
+    void FormatLargeFileOnAllCores();
+    void OverwriteLargeFileWithTimeout();
+    void DiffLargeFileWithTimeout();
+    void FormatStdInWithTimeout();
+    void CaptureSlowFile();
+    void CaptureSlowFile_data();
+    void OverwriteStagedFile();
+    void ListStagedFileNextToSubmodule();
+    void ListChangedSinceRef();
+    void WatchFormatsChangedFileOnce();
     void FormatWithDifferentTabAndIndentSize();
     void InvalidIndentationError();
     